@@ -44,7 +44,8 @@
 
 #include "err.h"
 
-static list_t *__err_key = 0;
+/* per thread, worker threads hand their errors back on join */
+static __thread list_t *__err_key = 0;
 
 static const char *__err_type_name[] = {
 	[ERR_NONE] = "none",
@@ -0,0 +1,290 @@
+/* IBM_PROLOG_BEGIN_TAG                                                   */
+/* This is an automatically generated prolog.                             */
+/*                                                                        */
+/* $Source: fcp/src/cmd_batch.c $                                         */
+/*                                                                        */
+/* OpenPOWER FFS Project                                                  */
+/*                                                                        */
+/* Contributors Listed Below - COPYRIGHT 2014,2015                        */
+/* [+] International Business Machines Corp.                              */
+/*                                                                        */
+/*                                                                        */
+/* Licensed under the Apache License, Version 2.0 (the "License");        */
+/* you may not use this file except in compliance with the License.       */
+/* You may obtain a copy of the License at                                */
+/*                                                                        */
+/*     http://www.apache.org/licenses/LICENSE-2.0                         */
+/*                                                                        */
+/* Unless required by applicable law or agreed to in writing, software    */
+/* distributed under the License is distributed on an "AS IS" BASIS,      */
+/* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or        */
+/* implied. See the License for the specific language governing           */
+/* permissions and limitations under the License.                         */
+/*                                                                        */
+/* IBM_PROLOG_END_TAG                                                     */
+
+/*
+ *    File: cmd_batch.c
+ *   Descr: batch implementation
+ *    Date: 10/18/2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <ctype.h>
+#include <regex.h>
+
+#include <clib/attribute.h>
+#include <clib/list.h>
+#include <clib/list_iter.h>
+#include <clib/misc.h>
+#include <clib/min.h>
+#include <clib/err.h>
+#include <clib/raii.h>
+
+#include "misc.h"
+#include "main.h"
+
+#define DELIM		'='
+#define ARGS_MAX	(FFS_USER_WORDS + 2)
+
+/*
+ * One edit per line, '#' starts a comment:
+ *
+ *   user  <name> <word>=<value> ...
+ *   trunc <name> [<size>]
+ */
+static int __apply(args_t * args, ffs_t * ffs, off_t offset,
+		   size_t n, char * argv[], int argc)
+{
+	assert(args != NULL);
+	assert(ffs != NULL);
+
+	const char * script = args->opt[1];
+	const char * cmd = argv[0];
+
+	if (argc < 2) {
+		UNEXPECTED("%s:%zd: '%s' requires a partition name", script,
+			   n + 1, cmd);
+		return -1;
+	}
+
+	ffs_entry_t entry;
+	if (__ffs_entry_find(ffs, argv[1], &entry) == false) {
+		UNEXPECTED("%s:%zd: partition entry '%s' not found\n", script,
+			   n + 1, argv[1]);
+		return -1;
+	}
+
+	char full_name[page_size];
+	if (__ffs_entry_name(ffs, &entry, full_name,
+			     sizeof full_name) < 0)
+		return -1;
+
+	if (args->protected != f_PROTECTED &&
+	    entry.flags & FFS_FLAGS_PROTECTED) {
+		if (args->verbose == f_VERBOSE)
+			fprintf(stderr, "%8llx: %s: protected (skip)\n",
+				(long long)offset, full_name);
+		return 0;
+	}
+
+	if (strcmp(cmd, "user") == 0) {
+		for (int i = 2; i < argc; i++) {
+			char * __value = strrchr(argv[i], DELIM);
+			if (__value == NULL) {
+				UNEXPECTED("%s:%zd: invalid user '%s', use "
+					   "form '<word>=<value>'\n", script,
+					   n + 1, argv[i]);
+				return -1;
+			}
+			*__value = '\0';
+
+			uint32_t word = 0, value = 0;
+			if (parse_number(argv[i], &word) < 0)
+				return -1;
+			if (parse_number(__value + 1, &value) < 0)
+				return -1;
+
+			if (__ffs_entry_user_put(ffs, full_name, word,
+						 value) < 0)
+				return -1;
+
+			if (args->verbose == f_VERBOSE)
+				fprintf(stderr, "%8llx: %s: [%02d] = %08x\n",
+					(long long)offset, full_name, word,
+					value);
+		}
+	} else if (strcmp(cmd, "trunc") == 0) {
+		if (3 < argc) {
+			UNEXPECTED("%s:%zd: invalid trunc, use form 'trunc "
+				   "<name> [<size>]'\n", script, n + 1);
+			return -1;
+		}
+
+		if (entry.type == FFS_TYPE_LOGICAL) {
+			if (args->verbose == f_VERBOSE)
+				fprintf(stderr, "%8llx: %s: logical (skip)\n",
+					(long long)offset, full_name);
+			return 0;
+		}
+
+		uint32_t size = entry.size * ffs->hdr->block_size;
+		if (argc == 3 && parse_number(argv[2], &size) < 0)
+			return -1;
+
+		if (__ffs_entry_truncate(ffs, full_name, size) < 0)
+			return -1;
+
+		if (args->verbose == f_VERBOSE)
+			fprintf(stderr, "%8llx: %s: truncate '%x' (done)\n",
+				(long long)offset, full_name, size);
+	} else {
+		UNEXPECTED("%s:%zd: unknown batch command '%s'", script,
+			   n + 1, cmd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int __batch(args_t * args, off_t offset, char ** line, size_t line_nr)
+{
+	assert(args != NULL);
+
+	char * type = args->dst_type;
+	char * target = args->dst_target;
+
+	RAII(FILE*, file, __fopen(type, target, "r+", debug), fclose);
+	if (file == NULL)
+		return -1;
+	if (check_file(target, file, offset) < 0)
+		return -1;
+	RAII(ffs_t*, ffs, __ffs_fopen(file, offset), __ffs_fclose);
+	if (ffs == NULL)
+		return -1;
+	if (__ffs_sync_policy(ffs, args->sync) < 0)
+		return -1;
+
+	if (ffs->count <= 0)
+		return 0;
+
+	if (__ffs_txn_begin(ffs) < 0)
+		return -1;
+
+	for (size_t n = 0; n < line_nr; n++) {
+		char __line[strlen(line[n]) + 1];
+		strcpy(__line, line[n]);
+
+		char * comment = strchr(__line, '#');
+		if (comment != NULL)
+			*comment = '\0';
+
+		char * argv[ARGS_MAX + 1], * save = NULL;
+		int argc = 0;
+
+		char * tok = strtok_r(__line, " \t\r\n", &save);
+		while (tok != NULL && argc <= ARGS_MAX) {
+			argv[argc++] = tok;
+			tok = strtok_r(NULL, " \t\r\n", &save);
+		}
+
+		if (argc == 0)
+			continue;
+
+		if (__apply(args, ffs, offset, n, argv, argc) < 0) {
+			(void)__ffs_txn_abort(ffs);
+			return -1;
+		}
+	}
+
+	return __ffs_txn_commit(ffs);
+}
+
+int command_batch(args_t * args)
+{
+	assert(args != NULL);
+
+	const char * script = args->opt[1];
+
+	/* the script is read once up front, it may be stdin */
+	RAII(FILE*, in, strcmp(script, "-") ? fopen(script, "r") :
+	     fdopen(dup(fileno(stdin)), "r"), fclose);
+	if (in == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	char ** line = NULL;
+	size_t line_nr = 0, line_sz = 0;
+
+	char * buf = NULL;
+	size_t buf_sz = 0;
+
+	int rc = 0;
+
+	while (getline(&buf, &buf_sz, in) != -1) {
+		if (line_sz <= line_nr) {
+			line_sz += 32;
+			char ** __line = realloc(line, line_sz * sizeof(*line));
+			if (__line == NULL) {
+				ERRNO(errno);
+				rc = -1;
+				break;
+			}
+			line = __line;
+		}
+
+		line[line_nr++] = buf;
+		buf = NULL, buf_sz = 0;
+	}
+	free(buf);
+
+	if (rc == 0 && ferror(in)) {
+		ERRNO(errno);
+		rc = -1;
+	}
+
+	char * end = (char *)args->offset;
+	while (rc == 0 && end != NULL && *end != '\0') {
+		errno = 0;
+		off_t offset = strtoull(end, &end, 0);
+		if (end == NULL || errno != 0) {
+			UNEXPECTED("invalid --offset specified '%s'",
+				   args->offset);
+			rc = -1;
+			break;
+		}
+
+		if (*end != ',' && *end != ':' && *end != '\0') {
+			UNEXPECTED("invalid --offset separator "
+				   "character '%c'", *end);
+			rc = -1;
+			break;
+		}
+
+		rc = __batch(args, offset, line, line_nr);
+		if (rc < 0)
+			break;
+
+		if (*end == '\0')
+			break;
+		end++;
+	}
+
+	for (size_t i = 0; i < line_nr; i++)
+		free(line[i]);
+	free(line);
+
+	return rc;
+}
@@ -44,6 +44,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <regex.h>
+#include <pthread.h>
 
 #include <clib/attribute.h>
 #include <clib/list.h>
@@ -110,10 +111,299 @@ static int validate_files(ffs_t * src, ffs_t * dst)
 	return 0;
 }
 
+static int __copy_table(args_t * args,
+			ffs_t * src_ffs, ffs_entry_t * src_entry,
+			const char * full_src_name,
+			ffs_t * dst_ffs, const char * full_dst_name)
+{
+	if (__ffs_entry_truncate(dst_ffs, full_dst_name,
+				 src_entry->actual) < 0) {
+		ERRNO(errno);
+		return -1;
+	}
+	if (args->verbose == f_VERBOSE)
+		fprintf(stderr, "%8llx: %s: trunc size '%x' (done)\n",
+			(long long)dst_ffs->offset, full_dst_name, src_entry->actual);
+
+	uint32_t src_val, dst_val;
+	for (uint32_t i=0; i<FFS_USER_WORDS; i++) {
+		__ffs_entry_user_get(src_ffs, full_src_name, i, &src_val);
+		__ffs_entry_user_get(dst_ffs, full_dst_name, i, &dst_val);
+
+                if (args->force != f_FORCE && i == USER_DATA_VOL)
+                        continue;
+
+		if (src_val != dst_val) {
+			if (__ffs_entry_user_put(dst_ffs, full_dst_name,
+					         i, src_val) < 0)
+				return -1;
+		}
+	}
+	if (args->verbose == f_VERBOSE)
+		if (args->verbose == f_VERBOSE)
+			fprintf(stderr, "%8llx: %s: copy user[] from '%s' "
+				"(done)\n", (long long)dst_ffs->offset, full_dst_name,
+				src_ffs->path);
+
+	return 0;
+}
+
+/*
+ * With --jobs, the data of each eligible entry is copied by a pool of
+ * workers, each with its own pair of ffs objects (and so its own file
+ * offsets and descriptors) and each entry a disjoint extent.  Workers
+ * only copy data (FFS_COPY_DATA), the partition table is updated by the
+ * calling thread once every worker is done.  With the io_uring backend
+ * (even with a single job) each worker takes a run of entries at a time
+ * and hands it to __ffs_entries_copy(), which batches their I/O.
+ */
+struct copy_job {
+	ffs_entry_t src_entry;
+	char *src_name;
+	char *dst_name;
+	bool copy;
+	uint32_t written;
+	uint32_t skipped;
+};
+
+struct copy_pool {
+	args_t *args;
+	off_t offset;
+
+	struct copy_job *job;
+	size_t count;
+	size_t size;
+
+	pthread_mutex_t lock;
+	size_t next;
+	bool failed;
+	list_t errors;
+};
+
+static struct copy_pool *__copy_pool_create(args_t * args, off_t offset)
+{
+	struct copy_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		ERRNO(errno);
+		return NULL;
+	}
+
+	pool->args = args;
+	pool->offset = offset;
+	pthread_mutex_init(&pool->lock, NULL);
+	list_init(&pool->errors);
+
+	return pool;
+}
+
+static void __copy_pool_delete(struct copy_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	for (size_t i = 0; i < pool->count; i++) {
+		free(pool->job[i].src_name);
+		free(pool->job[i].dst_name);
+	}
+	free(pool->job);
+
+	/* errors not handed back to a caller */
+	while (list_empty(&pool->errors) == false)
+		err_delete(container_of(list_remove_head(&pool->errors),
+					err_t, node));
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static int __copy_queue(struct copy_pool *pool, ffs_entry_t * src_entry,
+			const char *src_name, const char *dst_name, bool copy)
+{
+	if (pool->count == pool->size) {
+		size_t size = max(pool->size * 2, (size_t)16);
+
+		struct copy_job *job = realloc(pool->job, size * sizeof(*job));
+		if (job == NULL) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		pool->job = job;
+		pool->size = size;
+	}
+
+	struct copy_job *job = &pool->job[pool->count];
+	memset(job, 0, sizeof(*job));
+
+	job->src_entry = *src_entry;
+	job->copy = copy;
+	job->src_name = strdup(src_name);
+	job->dst_name = strdup(dst_name);
+	if (job->src_name == NULL || job->dst_name == NULL) {
+		free(job->src_name);
+		free(job->dst_name);
+		ERRNO(errno);
+		return -1;
+	}
+
+	pool->count++;
+
+	return 0;
+}
+
+static int __copy_work(struct copy_pool *pool)
+{
+	args_t *args = pool->args;
+
+	RAII(FILE*, src_file, __fopen(args->src_type, args->src_target, "r",
+				      debug), fclose);
+	if (src_file == NULL)
+		return -1;
+	RAII(ffs_t*, src_ffs, __ffs_fopen(src_file, pool->offset),
+	     __ffs_fclose);
+	if (src_ffs == NULL)
+		return -1;
+	if (__ffs_io_backend(src_ffs, args->io) < 0)
+		return -1;
+
+	RAII(FILE*, dst_file, __fopen(args->dst_type, args->dst_target, "r+",
+				      debug), fclose);
+	if (dst_file == NULL)
+		return -1;
+	RAII(ffs_t*, dst_ffs, __ffs_fopen(dst_file, pool->offset),
+	     __ffs_fclose);
+	if (dst_ffs == NULL)
+		return -1;
+	if (__ffs_sync_policy(dst_ffs, args->sync) < 0)
+		return -1;
+	if (__ffs_io_backend(dst_ffs, args->io) < 0)
+		return -1;
+	if (args->diff == f_DIFF &&
+	    __ffs_write_mode(dst_ffs, FFS_WRITE_DIFF) < 0)
+		return -1;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		struct copy_job *job = NULL;
+		size_t count = 0;
+		if (pool->failed == false && pool->next < pool->count) {
+			/* a fair share of what is left, in one batch */
+			count = 1;
+			if (args->io == FFS_IO_URING)
+				count = min((size_t)FFS_IO_DEPTH,
+					    (pool->count - pool->next +
+					     args->jobs - 1) / args->jobs);
+			job = &pool->job[pool->next];
+			pool->next += count;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (job == NULL)
+			break;
+
+		ffs_pair_t pair[count];
+		size_t n = 0;
+
+		for (size_t i = 0; i < count; i++)
+			if (job[i].copy == true)
+				pair[n++] = (ffs_pair_t) {
+					.src_name = job[i].src_name,
+					.dst_name = job[i].dst_name };
+
+		if (__ffs_entries_copy(src_ffs, dst_ffs, pair, n,
+				       FFS_COPY_DATA) < 0)
+			return -1;
+
+		for (size_t i = 0, j = 0; i < count; i++) {
+			if (job[i].copy == false)
+				continue;
+			job[i].written = pair[j].written;
+			job[i].skipped = pair[j].skipped;
+			j++;
+		}
+	}
+
+	/* the data is durable before the table refers to it */
+	return __ffs_fsync(dst_ffs);
+}
+
+static void *__copy_worker(void *arg)
+{
+	struct copy_pool *pool = (struct copy_pool *)arg;
+
+	if (__copy_work(pool) < 0) {
+		pthread_mutex_lock(&pool->lock);
+		pool->failed = true;
+		fcp_errors_save(&pool->errors);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+static int __copy_run(struct copy_pool *pool, ffs_t * src_ffs,
+		      ffs_t * dst_ffs)
+{
+	args_t *args = pool->args;
+
+	if (pool->count == 0)
+		return 0;
+
+	size_t count = min((size_t)args->jobs, pool->count);
+	pthread_t worker[count];
+	size_t started = 0;
+
+	for (; started < count; started++) {
+		int rc = pthread_create(&worker[started], NULL,
+					__copy_worker, pool);
+		if (rc != 0) {
+			if (started == 0) {
+				ERRNO(rc);
+				return -1;
+			}
+			break;	/* make do with fewer workers */
+		}
+	}
+
+	for (size_t i = 0; i < started; i++)
+		pthread_join(worker[i], NULL);
+
+	if (pool->failed == true) {
+		fcp_errors_restore(&pool->errors);
+		return -1;
+	}
+
+	for (size_t i = 0; i < pool->count; i++) {
+		struct copy_job *job = &pool->job[i];
+
+		if (__copy_table(args, src_ffs, &job->src_entry,
+				 job->src_name, dst_ffs, job->dst_name) < 0)
+			return -1;
+
+		if (job->copy == false) {
+			if (args->verbose == f_VERBOSE)
+				fprintf(stderr, "%8llx: %s: copy from '%s' "
+					"(skip)\n", (long long)dst_ffs->offset,
+					job->dst_name, src_ffs->path);
+			continue;
+		}
+
+		if (args->verbose == f_VERBOSE)
+			fprintf(stderr, "%8llx: %s: copy from '%s' (done)\n",
+				(long long)dst_ffs->offset, job->dst_name,
+				src_ffs->path);
+		if (args->diff == f_DIFF)
+			fcp_report_counts(dst_ffs, job->dst_name,
+					  job->written, job->skipped);
+	}
+
+	return 0;
+}
+
 static int __copy_entry(args_t * args,
 			ffs_t * src_ffs, ffs_entry_t * src_entry,
 			ffs_t * dst_ffs, ffs_entry_t * dst_entry,
-			entry_list_t * done_list)
+			entry_list_t * done_list, struct copy_pool *pool)
 {
 	char full_src_name[page_size];
 	if (__ffs_entry_name(src_ffs, src_entry, full_src_name,
@@ -186,34 +476,18 @@ static int __copy_entry(args_t * args,
 		return -1;
 	}
 
-	if (__ffs_entry_truncate(dst_ffs, full_dst_name,
-				 src_entry->actual) < 0) {
-		ERRNO(errno);
-		return -1;
-	}
-	if (args->verbose == f_VERBOSE)
-		fprintf(stderr, "%8llx: %s: trunc size '%x' (done)\n",
-			(long long)dst_ffs->offset, full_dst_name, src_entry->actual);
-
-	uint32_t src_val, dst_val;
-	for (uint32_t i=0; i<FFS_USER_WORDS; i++) {
-		__ffs_entry_user_get(src_ffs, full_src_name, i, &src_val);
-		__ffs_entry_user_get(dst_ffs, full_dst_name, i, &dst_val);
-
-                if (args->force != f_FORCE && i == USER_DATA_VOL)
-                        continue;
+	if (pool != NULL) {
+		bool copy = entry_list_exists(done_list, src_entry) != 1;
+		if (copy == true && entry_list_add(done_list, src_entry) < 0)
+			return -1;
 
-		if (src_val != dst_val) {
-			if (__ffs_entry_user_put(dst_ffs, full_dst_name,
-					         i, src_val) < 0)
-				return -1;
-		}
+		return __copy_queue(pool, src_entry, full_src_name,
+				    full_dst_name, copy);
 	}
-	if (args->verbose == f_VERBOSE)
-		if (args->verbose == f_VERBOSE)
-			fprintf(stderr, "%8llx: %s: copy user[] from '%s' "
-				"(done)\n", (long long)dst_ffs->offset, full_dst_name,
-				src_ffs->path);
+
+	if (__copy_table(args, src_ffs, src_entry, full_src_name,
+			 dst_ffs, full_dst_name) < 0)
+		return -1;
 
 	if (entry_list_exists(done_list, src_entry) == 1) {
 		if (args->verbose == f_VERBOSE)
@@ -225,12 +499,92 @@ static int __copy_entry(args_t * args,
 	if (entry_list_add(done_list, src_entry) < 0)
 		return -1;
 
+	uint32_t written, skipped;
+	if (__ffs_info(dst_ffs, FFS_INFO_BLOCKS_WRITTEN, &written) < 0)
+		return -1;
+	if (__ffs_info(dst_ffs, FFS_INFO_BLOCKS_SKIPPED, &skipped) < 0)
+		return -1;
+
 	if (fcp_copy_entry(src_ffs, full_src_name, dst_ffs, full_dst_name) < 0)
 		return -1;
 
 	if (args->verbose == f_VERBOSE)
 		fprintf(stderr, "%8llx: %s: copy from '%s' (done)\n",
 		        (long long)dst_ffs->offset, full_dst_name, src_ffs->path);
+	if (args->diff == f_DIFF)
+		fcp_report_blocks(dst_ffs, full_dst_name, written, skipped);
+
+	return 0;
+}
+
+/*
+ * With the io_uring backend, the entries of a wildcard compare are queued
+ * and compared in one call at the end, so that their reads are batched.
+ */
+struct compare_queue {
+	ffs_pair_t *pair;
+	size_t count;
+	size_t size;
+};
+
+static void __compare_queue_delete(struct compare_queue *queue)
+{
+	if (queue == NULL)
+		return;
+
+	for (size_t i = 0; i < queue->count; i++) {
+		free((char *)queue->pair[i].src_name);
+		free((char *)queue->pair[i].dst_name);
+	}
+	free(queue->pair);
+	free(queue);
+}
+
+static int __compare_queue(struct compare_queue *queue,
+			   const char *src_name, const char *dst_name)
+{
+	if (queue->count == queue->size) {
+		size_t size = max(queue->size * 2, (size_t)16);
+
+		ffs_pair_t *pair = realloc(queue->pair, size * sizeof(*pair));
+		if (pair == NULL) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		queue->pair = pair;
+		queue->size = size;
+	}
+
+	ffs_pair_t *pair = &queue->pair[queue->count];
+	memset(pair, 0, sizeof(*pair));
+
+	pair->src_name = strdup(src_name);
+	pair->dst_name = strdup(dst_name);
+	if (pair->src_name == NULL || pair->dst_name == NULL) {
+		free((char *)pair->src_name);
+		free((char *)pair->dst_name);
+		ERRNO(errno);
+		return -1;
+	}
+
+	queue->count++;
+
+	return 0;
+}
+
+static int __compare_run(args_t * args, struct compare_queue *queue,
+			 ffs_t * src_ffs, ffs_t * dst_ffs)
+{
+	if (fcp_compare_entries(src_ffs, dst_ffs, queue->pair,
+				queue->count) < 0)
+		return -1;
+
+	if (args->verbose == f_VERBOSE)
+		for (size_t i = 0; i < queue->count; i++)
+			fprintf(stderr, "%8llx: %s: compare from '%s' "
+				"(done)\n", (long long)dst_ffs->offset,
+				queue->pair[i].dst_name, src_ffs->path);
 
 	return 0;
 }
@@ -238,7 +592,8 @@ static int __copy_entry(args_t * args,
 static int __compare_entry(args_t * args,
 			   ffs_t * src_ffs, ffs_entry_t * src_entry,
 			   ffs_t * dst_ffs, ffs_entry_t * dst_entry,
-			   entry_list_t * done_list)
+			   entry_list_t * done_list,
+			   struct compare_queue *queue)
 {
 	char full_src_name[page_size];
 	if (__ffs_entry_name(src_ffs, src_entry, full_src_name,
@@ -307,6 +662,9 @@ static int __compare_entry(args_t * args,
 	if (entry_list_add(done_list, src_entry) < 0)
 		return -1;
 
+	if (queue != NULL)
+		return __compare_queue(queue, full_src_name, full_dst_name);
+
 	if (fcp_compare_entry(src_ffs, full_src_name,
 			      dst_ffs, full_dst_name) < 0)
 		return -1;
@@ -388,6 +746,8 @@ static int __copy_compare(args_t * args, off_t offset, entry_list_t * done_list)
 	RAII(ffs_t*, src_ffs, __ffs_fopen(src_file, offset), __ffs_fclose);
 	if (src_ffs == NULL)
 		return -1;
+	if (__ffs_io_backend(src_ffs, args->io) < 0)
+		return -1;
 
 	src_ffs->path = basename(src_target);
 	done_list->ffs = src_ffs;
@@ -412,6 +772,13 @@ static int __copy_compare(args_t * args, off_t offset, entry_list_t * done_list)
 	RAII(ffs_t*, dst_ffs, __ffs_fopen(dst_file, offset), __ffs_fclose);
 	if (dst_ffs == NULL)
 		return -1;
+	if (__ffs_sync_policy(dst_ffs, args->sync) < 0)
+		return -1;
+	if (__ffs_io_backend(dst_ffs, args->io) < 0)
+		return -1;
+	if (args->diff == f_DIFF &&
+	    __ffs_write_mode(dst_ffs, FFS_WRITE_DIFF) < 0)
+		return -1;
 
 	dst_ffs->path = basename(dst_target);
 
@@ -453,13 +820,33 @@ static int __copy_compare(args_t * args, off_t offset, entry_list_t * done_list)
 	    dst_parent.type == FFS_TYPE_DATA) {
 		if (args->cmd == c_COPY)
 			return __copy_entry(args, src_ffs, &src_parent,
-					    dst_ffs, &dst_parent, done_list);
+					    dst_ffs, &dst_parent, done_list,
+					    NULL);
 		else
 			return __compare_entry(args, src_ffs, &src_parent,
-					       dst_ffs, &dst_parent, done_list);
+					       dst_ffs, &dst_parent, done_list,
+					       NULL);
 	} else if (src_parent.type == FFS_TYPE_LOGICAL &&
 		   dst_parent.type == FFS_TYPE_LOGICAL) {
 
+		RAII(struct copy_pool*, pool, NULL, __copy_pool_delete);
+		if (args->cmd == c_COPY &&
+		    (1 < args->jobs || args->io == FFS_IO_URING)) {
+			pool = __copy_pool_create(args, offset);
+			if (pool == NULL)
+				return -1;
+		}
+
+		RAII(struct compare_queue*, queue, NULL,
+		     __compare_queue_delete);
+		if (args->cmd == c_COMPARE && args->io == FFS_IO_URING) {
+			queue = calloc(1, sizeof(*queue));
+			if (queue == NULL) {
+				ERRNO(errno);
+				return -1;
+			}
+		}
+
 		RAII(entry_list_t*, src_list, entry_list_create(src_ffs),
 		     entry_list_delete);
 		if (src_list == NULL)
@@ -523,16 +910,22 @@ static int __copy_compare(args_t * args, off_t offset, entry_list_t * done_list)
 			if (args->cmd == c_COPY) {
 				if (__copy_entry(args, src_ffs, src_entry,
 						 dst_ffs, dst_entry,
-						 done_list) < 0)
+						 done_list, pool) < 0)
 					return -1;
 			} else if (args->cmd == c_COMPARE) {
 				if (__compare_entry(args, src_ffs, src_entry,
 						 dst_ffs, dst_entry,
-						 done_list) < 0) {
+						 done_list, queue) < 0) {
 					return -1;
 				}
 			}
 		}
+
+		if (pool != NULL && __copy_run(pool, src_ffs, dst_ffs) < 0)
+			return -1;
+		if (queue != NULL &&
+		    __compare_run(args, queue, src_ffs, dst_ffs) < 0)
+			return -1;
 	}
 
 	return 0;
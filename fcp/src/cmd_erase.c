@@ -80,6 +80,10 @@ static int __erase(args_t * args, off_t offset, entry_list_t * done_list)
 	RAII(ffs_t*, ffs, __ffs_fopen(file, offset), __ffs_fclose);
 	if (ffs == NULL)
 		return -1;
+	if (__ffs_sync_policy(ffs, args->sync) < 0)
+		return -1;
+	if (__ffs_io_backend(ffs, args->io) < 0)
+		return -1;
 
 	ffs->path = basename(target);
 	done_list->ffs = ffs;
@@ -150,12 +154,21 @@ static int __erase(args_t * args, off_t offset, entry_list_t * done_list)
 		if (entry_list_add(done_list, entry) < 0)
 			return -1;
 
+		uint32_t written, skipped;
+		if (__ffs_info(ffs, FFS_INFO_BLOCKS_WRITTEN, &written) < 0)
+			return -1;
+		if (__ffs_info(ffs, FFS_INFO_BLOCKS_SKIPPED, &skipped) < 0)
+			return -1;
+
 		if (fcp_erase_entry(ffs, full_name, (char)fill) < 0)
 			return -1;
 
 		if (args->verbose == f_VERBOSE)
 			fprintf(stderr, "%8llx: %s: erase partition (done)\n",
 			        (long long)offset, full_name);
+
+		if (args->diff == f_DIFF)
+			fcp_report_blocks(ffs, full_name, written, skipped);
 	}
 
 	return 0;
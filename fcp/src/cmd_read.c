@@ -68,11 +68,13 @@ static int __read(args_t * args, off_t offset, entry_list_t * done_list)
 	RAII(FILE*, file, __fopen(type, target, "r", debug), fclose);
 	if (file == NULL)
 		return -1;
-	if (check_file(target, file, offset) < 0)
-		return -1;
-	RAII(ffs_t*, ffs, __ffs_fopen(file, offset), __ffs_fclose);
+	/* only the header is checked, entries are checked on lookup */
+	RAII(ffs_t*, ffs, __ffs_fopen_flags(file, offset, FFS_OPEN_LAZY),
+	     __ffs_fclose);
 	if (ffs == NULL)
 		return -1;
+	if (__ffs_io_backend(ffs, args->io) < 0)
+		return -1;
 
 	done_list->ffs = ffs;
 
@@ -74,6 +74,8 @@ static int __user(args_t * args, off_t offset)
 	RAII(ffs_t*, ffs, __ffs_fopen(file, offset), __ffs_fclose);
 	if (ffs == NULL)
 		return -1;
+	if (__ffs_sync_policy(ffs, args->sync) < 0)
+		return -1;
 
 	if (ffs->count <= 0)
 		return 0;
@@ -74,6 +74,13 @@ static int __write(args_t * args, off_t offset, entry_list_t * done_list)
 	RAII(ffs_t*, ffs, __ffs_fopen(file, offset), __ffs_fclose);
 	if (ffs == NULL)
 		return -1;
+	if (__ffs_sync_policy(ffs, args->sync) < 0)
+		return -1;
+	if (__ffs_io_backend(ffs, args->io) < 0)
+		return -1;
+	if (args->diff == f_DIFF &&
+	    __ffs_write_mode(ffs, FFS_WRITE_DIFF) < 0)
+		return -1;
 
 	ffs->path = basename(target);
 	done_list->ffs = ffs;
@@ -112,7 +119,8 @@ static int __write(args_t * args, off_t offset, entry_list_t * done_list)
 	}
 
 	struct stat st;
-	if (stat(in_path, &st) < 0) {
+	if ((strcmp(in_path, "-") == 0 ? fstat(fileno(stdin), &st) :
+	     stat(in_path, &st)) < 0) {
 		ERRNO(errno);
 		return -1;
 	}
@@ -139,6 +147,12 @@ static int __write(args_t * args, off_t offset, entry_list_t * done_list)
 	if (entry_list_add(done_list, &entry) < 0)
 		return -1;
 
+	uint32_t written, skipped;
+	if (__ffs_info(ffs, FFS_INFO_BLOCKS_WRITTEN, &written) < 0)
+		return -1;
+	if (__ffs_info(ffs, FFS_INFO_BLOCKS_SKIPPED, &skipped) < 0)
+		return -1;
+
 	if (strcmp(in_path, "-") == 0) {
 		if (fcp_write_entry(ffs, full_name, stdin) < 0)
 			return -1;
@@ -157,6 +171,9 @@ static int __write(args_t * args, off_t offset, entry_list_t * done_list)
 				(long long)offset, full_name, in_path);
 	}
 
+	if (args->diff == f_DIFF)
+		fcp_report_blocks(ffs, full_name, written, skipped);
+
 	return 0;
 }
 
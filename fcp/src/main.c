@@ -76,7 +76,10 @@ static void usage(bool verbose)
 		"\n     [-b <size>] [-o <offset,...>] [-fpvdh]\n");
 	fprintf(e," fcp [<src_type>:]<src_target>[:<src_name>] "
 		  "[<dst_type>:]<dst_target>[:<dst_name>]  -RWCM"
-		  "\n     [-b <size>] [-o <offset,...>] [-fpvdh]\n");
+		  "\n     [-b <size>] [-o <offset,...>] [-s <sync>] [-i <io>] "
+		  "[-j <jobs>] [-fpDvdh]\n");
+	fprintf(e," fcp [<dst_type>:]<dst_target> <script> -B"
+		  "\n     [-o <offset,...>] [-fpvdh]\n");
 	fprintf(e, "\n");
 	fprintf(e, "    <type>\n");
 	fprintf(e, "       'aa' : Aardvark USB probe\n");
@@ -129,6 +132,9 @@ static void usage(bool verbose)
 		fprintf(e, " fcp -U 0 1 2 nor.mif:bank0/spl\n");
 		fprintf(e, " fcp -U 0=0xffffffff 1=0 nor.mif:bank0/spl\n");
 		fprintf(e, "\n");
+		fprintf(e, " fcp -B nor.mif edits.txt\n");
+		fprintf(e, " cat edits.txt | fcp -B nor.mif -\n");
+		fprintf(e, "\n");
 	}
 
 	/* =============================== */
@@ -191,7 +197,17 @@ static void usage(bool verbose)
 	if (verbose)
 		fprintf(e,
 			"\n  Get or set a user word.  <word> and <value> are "
-			"decimal (or hex) numbers.\n");
+			"decimal (or hex) numbers.\n\n");
+
+	fprintf(e, "  -B, --batch\n");
+	if (verbose)
+		fprintf(e,
+			"\n  Apply the edits of a script file (use '-' for "
+			"stdin), one per line:\n\n"
+			"\tuser  <name> <word>=<value> ...\n"
+			"\ttrunc <name> [<size>]\n\n"
+			"  Each partition table is written once, if any edit "
+			"fails the table is\n  left unchanged.\n");
 
 	fprintf(e, "\n");
 
@@ -205,7 +221,34 @@ static void usage(bool verbose)
 	fprintf(e, "  -b, --buffer <value>\n");
 	if (verbose)
 		fprintf(e,
-			"\n  Ignored.\n\n");
+			"\n  Size of the transfer buffer, in bytes, rounded "
+			"down to a whole\n  number of blocks (default 1MiB).  "
+			"Buffers are reused across\n  partitions.\n\n");
+
+	fprintf(e, "  -s, --sync   <none|barrier|writeback>\n");
+	if (verbose)
+		fprintf(e,
+			"\n  When written data is forced to disk.  'none' leaves "
+			"it to the kernel,\n  'barrier' (default) syncs after "
+			"each partition and table update,\n  'writeback' also "
+			"starts write-back while a partition is written.\n\n");
+
+	fprintf(e, "  -i, --io     <pread|uring|direct>\n");
+	if (verbose)
+		fprintf(e,
+			"\n  I/O backend for partition data.  'uring' batches "
+			"reads and writes\n  through io_uring, across small "
+			"partitions for a wildcard --copy\n  or --compare.  "
+			"'direct' bypasses the page cache with O_DIRECT.\n  "
+			"Both fall back to 'pread' (default) when not "
+			"available.\n\n");
+
+	fprintf(e, "  -j, --jobs   <value>\n");
+	if (verbose)
+		fprintf(e,
+			"\n  Number of partitions copied in parallel by "
+			"--copy (default 1).  The\n  partition table is "
+			"updated once all the data is copied.\n\n");
 	fprintf(e, "\n");
 
 	/* =============================== */
@@ -221,6 +264,19 @@ static void usage(bool verbose)
 		fprintf(e, "\n  Do not ignore protected partition "
 			"entries\n\n");
 
+	fprintf(e, "  -D, --diff\n");
+	if (verbose)
+		fprintf(e, "\n  Read back the destination and only write "
+			"the blocks that differ,\n  report the number of "
+			"blocks programmed and skipped\n\n");
+
+	fprintf(e, "  -a, --all\n");
+	if (verbose)
+		fprintf(e, "\n  Compare the whole partition and write every "
+			"range that differs to\n  stdout, one '<name> "
+			"<offset> <length>' line each, offsets are\n  "
+			"relative to the start of the partition\n\n");
+
 	fprintf(e, "  -v, --verbose\n");
 	if (verbose)
 		fprintf(e, "\n  Write progress messages to stdout\n\n");
@@ -253,6 +309,7 @@ static int process_argument(args_t * args, int opt, const char *optarg)
 	case c_TRUNC:		/* trunc */
 	case c_COMPARE:		/* compare */
 	case c_USER:		/* user */
+	case c_BATCH:		/* batch */
 		if (args->cmd != c_ERROR) {
 			UNEXPECTED("commands '%c' and '%c' are mutually "
 				   "exclusive", args->cmd, opt);
@@ -264,7 +321,44 @@ static int process_argument(args_t * args, int opt, const char *optarg)
 		args->offset = strdup(optarg);
 		break;
 	case o_BUFFER:		/* buffer */
-		/* We ignore it, it's useless but kept for backwards compat */
+		if (parse_size(optarg, &args->buffer) < 0)
+			return -1;
+		if (args->buffer == 0) {
+			UNEXPECTED("'%s' invalid buffer size", optarg);
+			return -1;
+		}
+		break;
+	case o_SYNC:		/* sync */
+		if (strcmp(optarg, "none") == 0)
+			args->sync = FFS_SYNC_NONE;
+		else if (strcmp(optarg, "barrier") == 0)
+			args->sync = FFS_SYNC_BARRIER;
+		else if (strcmp(optarg, "writeback") == 0)
+			args->sync = FFS_SYNC_WRITEBACK;
+		else {
+			UNEXPECTED("'%s' invalid sync policy", optarg);
+			return -1;
+		}
+		break;
+	case o_JOBS:		/* jobs */
+		if (parse_number(optarg, &args->jobs) < 0)
+			return -1;
+		if (args->jobs == 0) {
+			UNEXPECTED("'%s' invalid number of jobs", optarg);
+			return -1;
+		}
+		break;
+	case o_IO:		/* io */
+		if (strcmp(optarg, "pread") == 0)
+			args->io = FFS_IO_PREAD;
+		else if (strcmp(optarg, "uring") == 0)
+			args->io = FFS_IO_URING;
+		else if (strcmp(optarg, "direct") == 0)
+			args->io = FFS_IO_DIRECT;
+		else {
+			UNEXPECTED("'%s' invalid I/O backend", optarg);
+			return -1;
+		}
 		break;
 	case f_FORCE:		/* force */
 		args->force = (flag_t) opt;
@@ -272,6 +366,12 @@ static int process_argument(args_t * args, int opt, const char *optarg)
 	case f_PROTECTED:	/* protected */
 		args->protected = (flag_t) opt;
 		break;
+	case f_DIFF:		/* diff */
+		args->diff = (flag_t) opt;
+		break;
+	case f_ALL:		/* all */
+		args->all = (flag_t) opt;
+		break;
 	case f_VERBOSE:		/* verbose */
 		verbose = 1;
 		args->verbose = (flag_t) opt;
@@ -364,6 +464,18 @@ static int validate_args(args_t * args)
 			return -1;
 		}
 
+		if (parse_path(args->opt[0], &args->dst_type,
+			       &args->dst_target, &args->dst_name) < 0)
+			return -1;
+
+		break;
+	case c_BATCH:
+		if (args->opt_nr < 2) {
+			UNEXPECTED("invalid options, please see --help for "
+				   "details");
+			return -1;
+		}
+
 		if (parse_path(args->opt[0], &args->dst_type,
 			       &args->dst_target, &args->dst_name) < 0)
 			return -1;
@@ -477,7 +589,8 @@ static int validate_args(args_t * args)
 		void syntax(void) {
 			fprintf(stderr, "Syntax: %s <path> [<dst_type>:]"
 				"<dst_target>:<dst_name> --write [--verbose] "
-				"[--force] [--protected] [--buffer <value>]\n",
+				"[--force] [--protected] [--diff] "
+				"[--buffer <value>]\n",
 				args->short_name);
 		}
 		if (args->opt_nr != 2) {
@@ -492,7 +605,8 @@ static int validate_args(args_t * args)
 		void syntax(void) {
 			fprintf(stderr, "Syntax: %s [<dst_type>:]<dst_target>"
 				":<dst_name> --erase <value> [--verbose] "
-				"[--force] [--protected] [--buffer <value>]\n",
+				"[--force] [--protected] [--diff] "
+				"[--buffer <value>]\n",
 				args->short_name);
 		}
 		if (args->opt_nr != 2) {
@@ -526,12 +640,25 @@ static int validate_args(args_t * args)
 
 		REQ_FIELD(dst_name, user);
 
+	} else if (args->cmd == c_BATCH) {
+		void syntax(void) {
+			fprintf(stderr, "Syntax: %s [<dst_type>:]<dst_target>"
+				" <script> --batch [--verbose] [--protected]\n",
+				args->short_name);
+		}
+		if (args->opt_nr != 2) {
+			syntax();
+			UNEXPECTED("syntax error");
+			return -1;
+		}
+
 	} else if (args->cmd == c_COPY) {
 		void syntax(void) {
 			fprintf(stderr, "Syntax: %s [<src_type>:]<src_target>"
 				"[:<src_name>] [<dst_type>:]<dst_target>"
 				"[:<dst_name>] --copy [--verbose] [--force] "
-				"[--protected] [--buffer <value>]\n",
+				"[--protected] [--diff] [--jobs <value>] "
+				"[--buffer <value>]\n",
 				args->short_name);
 		}
 		if (args->opt_nr != 2) {
@@ -544,7 +671,7 @@ static int validate_args(args_t * args)
 			fprintf(stderr, "Syntax: %s [<src_type>:]<src_target>"
 				"[:<src_name>] [<dst_type>:]<dst_target>"
 				"[:<dst_name>] --compare [--verbose] [--force] "
-				"[--protected] [--buffer <value>]\n",
+				"[--protected] [--all]\n",
 				args->short_name);
 		}
 		if (args->opt_nr != 2) {
@@ -587,6 +714,9 @@ static int process_args(args_t * args)
 	case c_USER:
 		rc = command_user(args);
 		break;
+	case c_BATCH:
+		rc = command_batch(args);
+		break;
 	case c_COPY:
 	case c_COMPARE:
 		rc = command_copy_compare(args);
@@ -608,10 +738,15 @@ static void args_dump(args_t * args)
 	printf("cmd[%c]\n", args->cmd);
 	if (args->offset != NULL)
 		printf("offset[%s]\n", args->offset);
+	printf("buffer[%x]\n", args->buffer);
 	if (args->force != 0)
 		printf("force[%c]\n", args->force);
 	if (args->protected != 0)
 		printf("protected[%c]\n", args->protected);
+	if (args->diff != 0)
+		printf("diff[%c]\n", args->diff);
+	if (args->all != 0)
+		printf("all[%c]\n", args->all);
 	if (args->verbose != 0)
 		printf("verbose[%c]\n", args->verbose);
 	if (args->debug != 0)
@@ -636,12 +771,18 @@ int main(int argc, char *argv[])
 		{"trunc", no_argument, NULL, c_TRUNC},
 		{"compare", no_argument, NULL, c_COMPARE},
 		{"user", no_argument, NULL, c_USER},
+		{"batch", no_argument, NULL, c_BATCH},
 		/* options */
 		{"offset", required_argument, NULL, o_OFFSET},
 		{"buffer", required_argument, NULL, o_BUFFER},
+		{"sync", required_argument, NULL, o_SYNC},
+		{"io", required_argument, NULL, o_IO},
+		{"jobs", required_argument, NULL, o_JOBS},
 		/* flags */
 		{"force", no_argument, NULL, f_FORCE},
 		{"protected", no_argument, NULL, f_PROTECTED},
+		{"diff", no_argument, NULL, f_DIFF},
+		{"all", no_argument, NULL, f_ALL},
 		{"verbose", no_argument, NULL, f_VERBOSE},
 		{"debug", no_argument, NULL, f_DEBUG},
 		{"help", no_argument, NULL, f_HELP},
@@ -649,7 +790,7 @@ int main(int argc, char *argv[])
 	};
 
 	static const char *short_opt;
-	short_opt = "PLRWECTMUo:b:fpvdh";
+	short_opt = "PLRWECTMUBo:b:s:i:j:fpDavdh";
 
 	int rc = EXIT_FAILURE;
 
@@ -695,4 +836,7 @@ static void __ctor__(void)
 
 	args.short_name = program_invocation_short_name;
 	args.offset = "0x3F0000,0x7F0000";
+	args.buffer = FFS_COPY_BUFFER;
+	args.jobs = 1;
+	args.sync = FFS_SYNC_BARRIER;
 }
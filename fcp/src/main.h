@@ -37,6 +37,8 @@
 
 #include <stdio.h>
 
+#include <clib/list.h>
+
 #include <ffs/libffs.h>
 
 #define FCP_MAJOR	0x01
@@ -64,18 +66,24 @@ typedef enum {
 	c_TRUNC = 'T',
 	c_COMPARE = 'M',
 	c_USER = 'U',
+	c_BATCH = 'B',
 } cmd_t;
 
 typedef enum {
 	o_ERROR = 0,
 	o_OFFSET = 'o',
 	o_BUFFER = 'b',
+	o_SYNC = 's',
+	o_IO = 'i',
+	o_JOBS = 'j',
 } option_t;
 
 typedef enum {
 	f_ERROR = 0,
 	f_FORCE = 'f',
 	f_PROTECTED = 'p',
+	f_DIFF = 'D',
+	f_ALL = 'a',
 	f_VERBOSE = 'v',
 	f_DEBUG = 'd',
 	f_HELP = 'h',
@@ -90,10 +98,16 @@ typedef struct {
 
 	/* options */
 	const char *offset;
+	uint32_t buffer;
+	int sync;
+	int io;
+	uint32_t jobs;
 
 	/* flags */
 	flag_t force;
 	flag_t protected;
+	flag_t diff;
+	flag_t all;
 	flag_t verbose;
 	flag_t debug;
 
@@ -107,11 +121,18 @@ extern size_t page_size;
 extern int verbose;
 extern int debug;
 
+extern void * fcp_buffer(int, uint32_t, size_t *);
+extern void fcp_errors_save(list_t *);
+extern void fcp_errors_restore(list_t *);
+
 extern int fcp_read_entry(ffs_t *, const char *, FILE *);
 extern int fcp_write_entry(ffs_t *, const char *, FILE *);
 extern int fcp_erase_entry(ffs_t *, const char *, char);
 extern int fcp_copy_entry(ffs_t *, const char *, ffs_t *, const char *);
+extern void fcp_report_blocks(ffs_t *, const char *, uint32_t, uint32_t);
+extern void fcp_report_counts(ffs_t *, const char *, uint32_t, uint32_t);
 extern int fcp_compare_entry(ffs_t *, const char *, ffs_t *, const char *);
+extern int fcp_compare_entries(ffs_t *, ffs_t *, ffs_pair_t *, size_t);
 
 extern int command_probe(args_t *);
 extern int command_list(args_t *);
@@ -122,5 +143,6 @@ extern int command_copy_compare(args_t *);
 extern int command_trunc(args_t *);
 extern int command_compare(args_t *);
 extern int command_user(args_t *);
+extern int command_batch(args_t *);
 
 #endif /* __FCP_H__ */
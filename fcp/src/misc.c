@@ -43,7 +43,7 @@
 #include <getopt.h>
 #include <errno.h>
 #include <ctype.h>
-#include <regex.h>
+#include <pthread.h>
 
 #include <clib/attribute.h>
 #include <clib/version.h>
@@ -57,36 +57,255 @@
 #include "misc.h"
 #include "main.h"
 
-#define COMPARE_SIZE	256UL
+#define FCP_BUFFERS	2
 
-static regex_t * regex_create(const char * str)
+/*
+ * Transfer buffers are sized by --buffer, rounded down to whole blocks,
+ * allocated on first use and reused for every partition a command
+ * processes.  Memory use is bounded by FCP_BUFFERS * --buffer instead of
+ * the size of the flash.
+ */
+static struct {
+	void *data[FCP_BUFFERS];
+	size_t size;
+} pool;
+
+static void __pool_free(void) __destructor;
+static void __pool_free(void)
 {
-	assert(str != NULL);
+	for (int i = 0; i < FCP_BUFFERS; i++)
+		free(pool.data[i]), pool.data[i] = NULL;
+	pool.size = 0;
+}
 
-	regex_t * self = (regex_t *)malloc(sizeof(*self));
-	if (self == NULL) {
-		ERRNO(errno);
-		return self;
+void * fcp_buffer(int index, uint32_t block_size, size_t * size)
+{
+	assert(0 <= index && index < FCP_BUFFERS);
+	assert(0 < block_size);
+	assert(size != NULL);
+
+	size_t want = max(args.buffer - args.buffer % block_size,
+			  block_size);
+
+	if (pool.size != want)
+		__pool_free();
+
+	if (pool.data[index] == NULL) {
+		pool.data[index] = malloc(want);
+		if (pool.data[index] == NULL) {
+			ERRNO(errno);
+			return NULL;
+		}
+		pool.size = want;
+	}
+
+	*size = pool.size;
+
+	return pool.data[index];
+}
+
+/*
+ * The error stack is per thread.  A worker saves its errors before it
+ * exits, the thread that joins it restores them onto its own stack.
+ */
+void fcp_errors_save(list_t * errors)
+{
+	assert(errors != NULL);
+
+	err_t *err;
+	while ((err = err_get()) != NULL)
+		list_add_tail(errors, &err->node);
+}
+
+void fcp_errors_restore(list_t * errors)
+{
+	assert(errors != NULL);
+
+	while (list_empty(errors) == false)
+		err_put(container_of(list_remove_head(errors), err_t, node));
+}
+
+/*
+ * Reader/writer pipeline.  A reader thread fills the pool buffers in ring
+ * order while the calling thread writes them out, so the source and the
+ * destination are busy at the same time.  A buffer goes back to the
+ * reader only once it has been written, and buffers are written in the
+ * order they were read.  Errors raised by the reader are moved onto the
+ * caller's error stack after the join.
+ */
+typedef ssize_t (*transfer_fn)(void *, void *, size_t, off_t);
+
+struct pipeline {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	void *data[FCP_BUFFERS];
+	ssize_t count[FCP_BUFFERS];
+	bool full[FCP_BUFFERS];
+	size_t size;
+	size_t total;
+	bool stop;
+
+	transfer_fn read;
+	void *ctx;
+	list_t errors;
+};
+
+static void *__pipeline_reader(void *arg)
+{
+	struct pipeline *p = (struct pipeline *)arg;
+	size_t offset = 0;
+
+	for (int i = 0;; i = (i + 1) % FCP_BUFFERS) {
+		pthread_mutex_lock(&p->lock);
+		while (p->full[i] == true && p->stop == false)
+			pthread_cond_wait(&p->cond, &p->lock);
+		bool stop = p->stop;
+		pthread_mutex_unlock(&p->lock);
+
+		if (stop == true)
+			break;
+
+		size_t count = min(p->size, p->total - offset);
+
+		ssize_t rc = 0;
+		if (0 < count)
+			rc = p->read(p->ctx, p->data[i], count, offset);
+
+		if (rc < 0)
+			fcp_errors_save(&p->errors);
+
+		pthread_mutex_lock(&p->lock);
+		p->count[i] = rc;
+		p->full[i] = true;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+
+		if (rc <= 0)
+			break;
+
+		offset += rc;
+	}
+
+	return NULL;
+}
+
+static ssize_t __pipeline(transfer_fn read, void *read_ctx,
+			  transfer_fn write, void *write_ctx,
+			  size_t total, uint32_t block_size)
+{
+	struct pipeline p;
+	memset(&p, 0, sizeof p);
+
+	for (int i = 0; i < FCP_BUFFERS; i++) {
+		p.data[i] = fcp_buffer(i, block_size, &p.size);
+		if (p.data[i] == NULL)
+			return -1;
 	}
 
-	if (regcomp(self, str, REG_ICASE | REG_NOSUB) != 0) {
-		free(self);
+	p.total = total;
+	p.read = read;
+	p.ctx = read_ctx;
+	list_init(&p.errors);
+
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.cond, NULL);
+
+	pthread_t reader;
+	int rc = pthread_create(&reader, NULL, __pipeline_reader, &p);
+	if (rc != 0) {
+		pthread_cond_destroy(&p.cond);
+		pthread_mutex_destroy(&p.lock);
+		ERRNO(rc);
+		return -1;
+	}
+
+	ssize_t done = 0;
+
+	for (int i = 0;; i = (i + 1) % FCP_BUFFERS) {
+		pthread_mutex_lock(&p.lock);
+		while (p.full[i] == false)
+			pthread_cond_wait(&p.cond, &p.lock);
+		ssize_t count = p.count[i];
+		pthread_mutex_unlock(&p.lock);
+
+		if (count < 0)
+			done = -1;
+		if (count <= 0)
+			break;
+
+		if (write(write_ctx, p.data[i], count, done) < 0) {
+			done = -1;
+			break;
+		}
+
+		done += count;
+
+		pthread_mutex_lock(&p.lock);
+		p.full[i] = false;
+		pthread_cond_broadcast(&p.cond);
+		pthread_mutex_unlock(&p.lock);
+	}
+
+	pthread_mutex_lock(&p.lock);
+	p.stop = true;
+	pthread_cond_broadcast(&p.cond);
+	pthread_mutex_unlock(&p.lock);
+
+	pthread_join(reader, NULL);
+
+	fcp_errors_restore(&p.errors);
+
+	pthread_cond_destroy(&p.cond);
+	pthread_mutex_destroy(&p.lock);
+
+	return done;
+}
+
+struct transfer {
+	ffs_t *ffs;
+	const char *name;
+	FILE *file;
+	uint32_t actual;
+	uint32_t total;
+};
+
+static ssize_t __file_read(void *ctx, void *buf, size_t count, off_t offset)
+{
+	struct transfer *t = (struct transfer *)ctx;
+
+	size_t rc = fread(buf, 1, count, t->file);
+	if (rc == 0 && ferror(t->file)) {
 		ERRNO(errno);
-		return NULL;
+		return -1;
 	}
 
-	return self;
+	return rc;
 }
 
-static int regex_free(regex_t * self)
+static ssize_t __entry_read(void *ctx, void *buf, size_t count, off_t offset)
 {
-	if (self == NULL)
-		return 0;
+	struct transfer *t = (struct transfer *)ctx;
 
-	regfree(self);
-	free(self);
+	return __ffs_entry_read(t->ffs, t->name, buf, offset, count);
+}
 
-	return 0;
+static ssize_t __entry_write(void *ctx, void *buf, size_t count, off_t offset)
+{
+	struct transfer *t = (struct transfer *)ctx;
+
+	ssize_t rc = __ffs_entry_write(t->ffs, t->name, buf, offset, count);
+	if (rc < 0)
+		return -1;
+
+	t->total += rc;
+
+	if (isatty(fileno(stderr))) {
+		fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
+		fprintf(stderr, "%8x/%8x", t->actual, t->total);
+	}
+
+	return rc;
 }
 
 int parse_offset(const char *str, off_t *offset)
@@ -312,6 +531,31 @@ entry_list_t * entry_list_create(ffs_t * ffs)
 	return self;
 }
 
+struct entry_match {
+	entry_list_t * self;
+	const char * name;
+};
+
+static int entry_match(ffs_entry_t * entry, void * ctx)
+{
+	assert(entry != NULL);
+
+	struct entry_match * match = (struct entry_match *)ctx;
+
+	int rc = __ffs_entry_match(match->self->ffs, match->name, entry);
+	if (rc <= 0)
+		return rc;
+
+	return entry_list_add(match->self, entry);
+}
+
+static int child_entry_list(ffs_entry_t * child, void * ctx)
+{
+	assert(child != NULL);
+
+	return entry_list_add((entry_list_t *)ctx, child);
+}
+
 entry_list_t * entry_list_create_by_regex(ffs_t * ffs, const char * name)
 {
 	assert(ffs != NULL);
@@ -319,39 +563,13 @@ entry_list_t * entry_list_create_by_regex(ffs_t * ffs, const char * name)
 	if (name == NULL)
 		name = ".*";
 
-	RAII(regex_t*, rx, regex_create(name), regex_free);
-	if (rx == NULL)
-		return NULL;
-
 	entry_list_t * self = entry_list_create(ffs);
 	if (self == NULL)
 		return NULL;
 
-	int entry_list(ffs_entry_t * entry)
-	{
-		assert(entry != NULL);
-
-		char full_name[page_size];
-		if (__ffs_entry_name(ffs, entry, full_name,
-				     sizeof full_name) < 0)
-			return -1;
-		if (regexec(rx, full_name, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
+	struct entry_match match = {.self = self, .name = name};
 
-		entry_node_t * entry_node;
-		entry_node = (entry_node_t *)malloc(sizeof(*entry_node));
-		if (entry_node == NULL) {
-			ERRNO(errno);
-			return -1;
-		}
-
-		memcpy(&entry_node->entry, entry, sizeof(*entry));
-		list_add_tail(&self->list, &entry_node->node);
-
-		return 0;
-	}
-
-	if (__ffs_iterate_entries(ffs, entry_list) < 0) {
+	if (__ffs_iterate_entries_ctx(ffs, NULL, entry_match, &match) < 0) {
 		entry_list_delete(self);
 		return NULL;
 	}
@@ -382,27 +600,13 @@ int entry_list_add_child(entry_list_t * self, ffs_entry_t * parent)
 	assert(self != NULL);
 	assert(parent != NULL);
 
-	int child_entry_list(ffs_entry_t * child)
-	{
-		assert(child != NULL);
-
-		if (child->pid != parent->id)
-			return 0;
-
-		entry_node_t * entry_node;
-		entry_node = (entry_node_t *)malloc(sizeof(*entry_node));
-		if (entry_node == NULL) {
-			ERRNO(errno);
-			return -1;
-		}
-
-		memcpy(&entry_node->entry, child, sizeof(*child));
-		list_add_tail(&self->list, &entry_node->node);
+	ffs_filter_t filter = {
+		.pid = parent->id,
+		.type = FFS_FILTER_ANY,
+	};
 
-		return 0;
-	}
-
-	if (__ffs_iterate_entries(self->ffs, child_entry_list) < 0)
+	if (__ffs_iterate_entries_ctx(self->ffs, &filter, child_entry_list,
+				      self) < 0)
 		return -1;
 
 	return 0;
@@ -551,17 +755,11 @@ int fcp_read_entry(ffs_t * src, const char * name, FILE * out)
 	if (__ffs_info(src, FFS_INFO_BLOCK_SIZE, &block_size) < 0)
 		return -1;
 
-	uint32_t block_count;
-	if (__ffs_info(src, FFS_INFO_BLOCK_COUNT, &block_count) < 0)
+	size_t buffer_size;
+	void *buffer = fcp_buffer(0, block_size, &buffer_size);
+	if (buffer == NULL)
 		return -1;
 
-	size_t buffer_size = block_size * block_count;
-	RAII(void*, buffer, malloc(buffer_size), free);
-	if (buffer == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-
 	ffs_entry_t entry;
 	if (__ffs_entry_find(src, name, &entry) == false) {
 		UNEXPECTED("'%s' partition not found => %s",
@@ -587,7 +785,8 @@ int fcp_read_entry(ffs_t * src, const char * name, FILE * out)
 
 		ssize_t rc;
 		rc = __ffs_entry_read(src, name, buffer, offset, count);
-
+		if (rc < 0)
+			return -1;
 
 		rc = fwrite(buffer, 1, rc, out);
 		if (rc <= 0 && ferror(out)) {
@@ -621,17 +820,6 @@ int fcp_write_entry(ffs_t * dst, const char * name, FILE * in)
 	if (__ffs_info(dst, FFS_INFO_BLOCK_SIZE, &block_size) < 0)
 		return -1;
 
-	uint32_t block_count;
-	if (__ffs_info(dst, FFS_INFO_BLOCK_COUNT, &block_count) < 0)
-		return -1;
-
-	size_t buffer_size = block_size * block_count;
-	RAII(void*, buffer, malloc(buffer_size), free);
-	if (buffer == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-
 	ffs_entry_t entry;
 	if (__ffs_entry_find(dst, name, &entry) == false) {
 		UNEXPECTED("'%s' partition not found => %s",
@@ -643,43 +831,23 @@ int fcp_write_entry(ffs_t * dst, const char * name, FILE * in)
 	if (__ffs_info(dst, FFS_INFO_OFFSET, &poffset) < 0)
 		return -1;
 
-	uint32_t total = 0;
-	uint32_t size = entry.actual;
-	off_t offset = 0;
-
 	if (isatty(fileno(stderr))) {
 		fprintf(stderr, "%8x: %s: write partition %8x/%8x",
-			poffset, name, entry.actual, total);
+			poffset, name, entry.actual, 0);
 	}
 
-	while (0 < size) {
-		size_t count = min(buffer_size, size);
-
-		ssize_t rc;
-		rc = fread(buffer, 1, count, in);
-		if (rc <= 0) {
-			if (feof(in)) {
-				break;
-			} else if (ferror(in)) {
-				ERRNO(errno);
-				return -1;
-			}
-		}
+	struct transfer from = {.file = in};
+	struct transfer to = {.ffs = dst, .name = name,
+			      .actual = entry.actual};
 
-		rc = __ffs_entry_write(dst, name, buffer, offset, rc);
-
-		if (__ffs_fsync(dst) < 0)
-			return -1;
-
-		size -= rc;
-		total += rc;
-		offset += rc;
+	/* a pipe has no size, write until EOF or the end of the entry */
+	ssize_t total = __pipeline(__file_read, &from, __entry_write, &to,
+				   (size_t)entry.size * block_size, block_size);
+	if (total < 0)
+		return -1;
 
-		if (isatty(fileno(stderr))) {
-			fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-			fprintf(stderr, "%8x/%8x", entry.actual, total);
-		}
-	}
+	if (__ffs_fsync(dst) < 0)
+		return -1;
 
 	if (isatty(fileno(stderr))) {
 		fprintf(stderr, "\n");
@@ -697,19 +865,6 @@ int fcp_erase_entry(ffs_t * dst, const char * name, char fill)
 	if (__ffs_info(dst, FFS_INFO_BLOCK_SIZE, &block_size) < 0)
 		return -1;
 
-	uint32_t block_count;
-	if (__ffs_info(dst, FFS_INFO_BLOCK_COUNT, &block_count) < 0)
-		return -1;
-
-	size_t buffer_size = block_size * block_count;
-	RAII(void*, buffer, malloc(buffer_size), free);
-	if (buffer == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-
-	memset(buffer, fill, buffer_size);
-
 	ffs_entry_t entry;
 	if (__ffs_entry_find(dst, name, &entry) == false) {
 		UNEXPECTED("'%s' partition not found => %s",
@@ -721,35 +876,24 @@ int fcp_erase_entry(ffs_t * dst, const char * name, char fill)
 	if (__ffs_info(dst, FFS_INFO_OFFSET, &poffset) < 0)
 		return -1;
 
-	uint32_t total = 0;
-	uint32_t size = entry.size * block_size;
-	off_t offset = 0;
-
 	if (isatty(fileno(stderr))) {
 		fprintf(stderr, "%8x: %s: erase partition %8x/%8x",
-			poffset, name, entry.actual, total);
+			poffset, name, entry.actual, 0);
 	}
 
-	while (0 < size) {
-		size_t count = min(buffer_size, size);
-
-		ssize_t rc;
-		rc = __ffs_entry_write(dst, name, buffer, offset, count);
-
-		if (__ffs_fsync(dst) < 0)
-			return -1;
-
-		size -= rc;
-		total += rc;
-		offset += rc;
+	ssize_t total = __ffs_entry_fill(dst, name, (uint8_t)fill);
+	if (total < 0)
+		return -1;
 
-		if (isatty(fileno(stderr))) {
-			fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-			fprintf(stderr, "%8x/%8x", entry.size * block_size,
-				total);
-		}
+	if (isatty(fileno(stderr))) {
+		fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
+		fprintf(stderr, "%8x/%8x", entry.size * block_size,
+			(uint32_t)total);
 	}
 
+	if (__ffs_fsync(dst) < 0)
+		return -1;
+
 	if (__ffs_entry_truncate(dst, name, 0ULL) < 0) {
 		ERRNO(errno);
 		return -1;
@@ -770,21 +914,6 @@ int fcp_copy_entry(ffs_t * src, const char * src_name,
 	assert(dst != NULL);
 	assert(dst_name != NULL);
 
-	uint32_t block_size;
-	if (__ffs_info(src, FFS_INFO_BLOCK_SIZE, &block_size) < 0)
-		return -1;
-
-	uint32_t block_count;
-	if (__ffs_info(dst, FFS_INFO_BLOCK_COUNT, &block_count) < 0)
-		return -1;
-
-	size_t buffer_size = block_size * block_count;
-	RAII(void*, buffer, malloc(buffer_size), free);
-	if (buffer == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-
 	ffs_entry_t src_entry;
 	if (__ffs_entry_find(src, src_name, &src_entry) == false) {
 		UNEXPECTED("'%s' partition not found => %s",
@@ -792,53 +921,100 @@ int fcp_copy_entry(ffs_t * src, const char * src_name,
 		return -1;
 	}
 
-	ffs_entry_t dst_entry;
-	if (__ffs_entry_find(dst, dst_name, &dst_entry) == false) {
-		UNEXPECTED("'%s' partition not found => %s",
-			   dst->path, dst_name);
-		return -1;
-	}
-
-	uint32_t total = 0;
-	uint32_t size = src_entry.actual;
-	off_t offset = 0;
-
 	if (isatty(fileno(stderr))) {
 		fprintf(stderr, "%8llx: %s: copy partition %8x/%8x",
-			(long long)src->offset, dst_name, src_entry.actual, total);
+			(long long)src->offset, dst_name, src_entry.actual, 0);
 	}
 
-	while (0 < size) {
-		size_t count = min(buffer_size, size);
+	struct stat in, out;
+	if (fstat(fileno(src->file), &in) < 0 ||
+	    fstat(fileno(dst->file), &out) < 0) {
+		ERRNO(errno);
+		return -1;
+	}
 
-		ssize_t rc;
-		rc = __ffs_entry_read(src, src_name, buffer, offset, count);
-		if (rc < 0)
-			return -1;
-		rc = __ffs_entry_write(dst, dst_name, buffer, offset, rc);
-		if (rc < 0)
-			return -1;
+	ssize_t total;
 
-		if (__ffs_fsync(dst) < 0)
+	/*
+	 * The library copies between regular files in the kernel, and
+	 * within one file it knows about overlap.  Between distinct
+	 * devices, overlap the reads and the writes instead.
+	 */
+	if ((S_ISREG(in.st_mode) && S_ISREG(out.st_mode)) ||
+	    (in.st_dev == out.st_dev && in.st_ino == out.st_ino)) {
+		total = __ffs_entry_copy(src, src_name, dst, dst_name);
+	} else {
+		uint32_t block_size;
+		if (__ffs_info(dst, FFS_INFO_BLOCK_SIZE, &block_size) < 0)
 			return -1;
 
-		size -= rc;
-		total += rc;
-		offset += rc;
+		struct transfer from = {.ffs = src, .name = src_name};
+		struct transfer to = {.ffs = dst, .name = dst_name,
+				      .actual = src_entry.actual};
 
-		if (isatty(fileno(stderr))) {
-			fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-			fprintf(stderr, "%8x/%8x", (uint32_t)src_entry.actual, total);
-		}
+		total = __pipeline(__entry_read, &from, __entry_write, &to,
+				   src_entry.actual, block_size);
 	}
+	if (total < 0)
+		return -1;
+
+	if (__ffs_fsync(dst) < 0)
+		return -1;
 
 	if (isatty(fileno(stderr))) {
-		fprintf(stderr, "\n");
+		fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
+		fprintf(stderr, "%8x/%8x\n", (uint32_t)src_entry.actual,
+			(uint32_t)total);
 	}
 
 	return total;
 }
 
+void fcp_report_blocks(ffs_t * ffs, const char * name,
+		       uint32_t written, uint32_t skipped)
+{
+	assert(ffs != NULL);
+	assert(name != NULL);
+
+	uint32_t w = written, s = skipped;
+	__ffs_info(ffs, FFS_INFO_BLOCKS_WRITTEN, &w);
+	__ffs_info(ffs, FFS_INFO_BLOCKS_SKIPPED, &s);
+
+	fcp_report_counts(ffs, name, w - written, s - skipped);
+}
+
+void fcp_report_counts(ffs_t * ffs, const char * name,
+		       uint32_t programmed, uint32_t skipped)
+{
+	assert(ffs != NULL);
+	assert(name != NULL);
+
+	fprintf(stderr, "%8llx: %s: '%u' block(s) programmed, '%u' "
+		"skipped\n", (long long)ffs->offset, name, programmed,
+		skipped);
+}
+
+struct compare_diff {
+	const char * name;
+	off_t first;
+};
+
+static int compare_diff(off_t offset, size_t size, void * ctx)
+{
+	struct compare_diff * diff = (struct compare_diff *)ctx;
+
+	if (diff->first < 0)
+		diff->first = offset;
+
+	/* first difference only */
+	if (args.all != f_ALL)
+		return 1;
+
+	printf("%s 0x%llx 0x%zx\n", diff->name, (long long)offset, size);
+
+	return 0;
+}
+
 int fcp_compare_entry(ffs_t * src, const char * src_name,
 		      ffs_t * dst, const char * dst_name)
 {
@@ -847,27 +1023,6 @@ int fcp_compare_entry(ffs_t * src, const char * src_name,
 	assert(dst != NULL);
 	assert(dst_name != NULL);
 
-	uint32_t block_size;
-	if (__ffs_info(src, FFS_INFO_BLOCK_SIZE, &block_size) < 0)
-		return -1;
-
-	uint32_t block_count;
-	if (__ffs_info(dst, FFS_INFO_BLOCK_COUNT, &block_count) < 0)
-		return -1;
-
-	size_t buffer_size = block_size * block_count;
-
-	RAII(void*, src_buffer, malloc(buffer_size), free);
-	if (src_buffer == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-	RAII(void*, dst_buffer, malloc(buffer_size), free);
-	if (dst_buffer == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-
 	ffs_entry_t src_entry;
 	if (__ffs_entry_find(src, src_name, &src_entry) == false) {
 		UNEXPECTED("'%s' partition not found => %s",
@@ -882,62 +1037,86 @@ int fcp_compare_entry(ffs_t * src, const char * src_name,
 		return -1;
 	}
 
-	uint32_t total = 0;
-	uint32_t size = src_entry.actual;
-	off_t offset = 0;
-
 	if (isatty(fileno(stderr))) {
 		fprintf(stderr, "%8llx: %s: compare partition %8x/%8x",
-			(long long)src->offset, dst_name, src_entry.actual, total);
+			(long long)src->offset, dst_name, src_entry.actual, 0);
 	}
 
-	while (0 < size) {
-		size_t count = min(buffer_size, size);
+	struct compare_diff diff = {.name = dst_name, .first = -1};
 
-		ssize_t rc;
-		rc = __ffs_entry_read(src, src_name, src_buffer, offset, count);
-		if (rc < 0)
-			return -1;
-		rc = __ffs_entry_read(dst, dst_name, dst_buffer, offset, rc);
-		if (rc < 0)
-			return -1;
+	ssize_t rc = __ffs_entry_compare(src, src_name, dst, dst_name,
+					 compare_diff, &diff);
+	if (rc < 0)
+		return -1;
 
-		char * src_ptr = src_buffer;
-		char * dst_ptr = dst_buffer;
-		size_t cnt = 0;
+	if (0 < rc) {
+		if (args.all != f_ALL)
+			UNEXPECTED("MISCOMPARE! '%s' != '%s' at "
+				   "offset '%llx'\n", src_name,
+				   dst_name, (long long)diff.first);
+		else
+			UNEXPECTED("MISCOMPARE! '%s' != '%s' in '%zd' "
+				   "ranges from offset '%llx'\n", src_name,
+				   dst_name, rc, (long long)diff.first);
 
-		while (cnt < count) {
-			size_t cmp_sz = min(count - cnt, COMPARE_SIZE);
+		if (isatty(fileno(stderr)))
+			fprintf(stderr, " <== [ERROR]\n");
 
-			if (memcmp(src_ptr, dst_ptr, cmp_sz) != 0) {
-				UNEXPECTED("MISCOMPARE! '%s' != '%s' at "
-					   "offset '%llx'\n", src_name,
-					   dst_name, (long long)offset + cnt);
+		return -1;
+	}
 
-				if (isatty(fileno(stderr)))
-					fprintf(stderr, " <== [ERROR]\n");
+	if (isatty(fileno(stderr))) {
+		fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
+		fprintf(stderr, "%8x/%8x\n", src_entry.actual,
+			src_entry.actual);
+	}
 
-				return -1;
-			}
+	return src_entry.actual;
+}
 
-			src_ptr += cmp_sz;
-			dst_ptr += cmp_sz;
-			cnt += cmp_sz;
-		}
+/*
+ * Compare several pairs of entries in one call, so that the library can
+ * batch their reads, and report the first pair that differs the same way
+ * fcp_compare_entry() does.
+ */
+int fcp_compare_entries(ffs_t * src, ffs_t * dst, ffs_pair_t * pair,
+			size_t count)
+{
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(pair != NULL);
 
-		size -= rc;
-		total += rc;
-		offset += rc;
+	RAII(struct compare_diff *, diff, calloc(count, sizeof(*diff)), free);
+	if (0 < count && diff == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
 
-		if (isatty(fileno(stderr))) {
-			fprintf(stderr, "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b");
-			fprintf(stderr, "%8x/%8x", src_entry.actual, total);
-		}
+	for (size_t i = 0; i < count; i++) {
+		diff[i] = (struct compare_diff) {
+			.name = pair[i].dst_name, .first = -1 };
+		pair[i].ctx = &diff[i];
 	}
 
-	if (isatty(fileno(stderr))) {
-		fprintf(stderr, "\n");
+	if (__ffs_entries_compare(src, dst, pair, count, compare_diff) < 0)
+		return -1;
+
+	for (size_t i = 0; i < count; i++) {
+		if (pair[i].rc == 0)
+			continue;
+
+		if (args.all != f_ALL)
+			UNEXPECTED("MISCOMPARE! '%s' != '%s' at "
+				   "offset '%llx'\n", pair[i].src_name,
+				   pair[i].dst_name, (long long)diff[i].first);
+		else
+			UNEXPECTED("MISCOMPARE! '%s' != '%s' in '%zd' "
+				   "ranges from offset '%llx'\n",
+				   pair[i].src_name, pair[i].dst_name,
+				   pair[i].rc, (long long)diff[i].first);
+
+		return -1;
 	}
 
-	return total;
+	return 0;
 }
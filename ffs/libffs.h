@@ -28,18 +28,69 @@
 
 #include <stdbool.h>
 #include <stdarg.h>
+#include <endian.h>
+#include <regex.h>
 
 
+#include <clib/tree.h>
+
 #include "ffs.h"
 
 typedef struct ffs_entry ffs_entry_t;
 typedef struct ffs_hdr ffs_hdr_t;
 typedef enum type ffs_type_t;
+typedef struct ffs_ring ffs_ring_t;
 
 #define FFS_EXCEPTION_DATA	1024
 
 /* ============================================================ */
 
+/*!
+ * @brief data extent (in blocks) of a partition entry
+ */
+struct ffs_extent {
+    tree_node_t node;
+
+    uint32_t base;
+    uint32_t size;
+    uint32_t id;
+
+    uint32_t index;
+};
+
+typedef struct ffs_extent ffs_extent_t;
+
+/*!
+ * @brief compiled entry name pattern, see __ffs_entry_match()
+ */
+struct ffs_pattern {
+    char * pattern;
+
+    bool regex;
+    regex_t rx;
+
+    const char * literal;
+    size_t literal_len;
+    bool head;
+    bool tail;
+};
+
+typedef struct ffs_pattern ffs_pattern_t;
+
+#define FFS_PATTERN_CACHE	4
+
+/*!
+ * @brief byte range [start, end) of partition data
+ */
+struct ffs_range {
+    off_t start;
+    off_t end;
+};
+
+typedef struct ffs_range ffs_range_t;
+
+#define FFS_RANGE_MAX		64
+
 /*!
  * @brief ffs I/O interface
  */
@@ -52,7 +103,71 @@ struct ffs {
     FILE * file;
     uint32_t count;
 
+    uint32_t * index;
+    uint32_t index_size;
+    uint32_t index_used;
+
+    uint32_t * child;
+    uint32_t * sibling;
+    uint32_t * parent;
+    uint32_t tombstones;
+
+    uint32_t max_id;
+    uint32_t free_slot;
+    uint32_t part;
+
+    char ** names;
+    uint32_t names_count;
+
+    ffs_pattern_t pattern[FFS_PATTERN_CACHE];
+    uint32_t pattern_next;
+
+    tree_t extents;
+    ffs_extent_t * extent;
+    uint32_t extent_count;
+    bool overlap;
+    bool extents_stale;
+
+    ffs_hdr_t * txn;
+    uint32_t txn_count;
+    uint32_t txn_tombstones;
+    bool txn_dirty;
+    bool txn_overlap;
+    uint32_t * txn_valid;
+    uint32_t txn_valid_size;
+    uint32_t * txn_dirty_map;
+    uint32_t txn_dirty_size;
+
+    uint32_t * dirty_map;
+    uint32_t dirty_size;
     bool dirty;
+
+    ffs_hdr_t * wire;
+    size_t wire_size;
+
+    void * map;
+    size_t map_size;
+
+    uint32_t * valid_map;
+    uint32_t valid_size;
+    bool lazy;
+
+    int sync;
+    bool unsynced;
+    off_t wb_start;
+    off_t wb_end;
+    ffs_range_t * written;
+    uint32_t written_count;
+    uint32_t written_size;
+
+    int write_mode;
+    uint32_t blocks_written;
+    uint32_t blocks_skipped;
+
+    int io;
+    ffs_ring_t * ring;
+    int direct;
+    size_t align;
 };
 
 typedef struct ffs ffs_t;
@@ -64,6 +179,38 @@ struct ffs_exception {
 
 typedef struct ffs_exception ffs_exception_t;
 
+/*!
+ * @brief entry filter for __ffs_iterate_entries_ctx(), entries that don't
+ *        match are skipped without calling back
+ */
+struct ffs_filter {
+    uint32_t pid;		/* parent id, or FFS_FILTER_ANY */
+    uint32_t type;		/* entry type, or FFS_FILTER_ANY */
+    uint32_t flags;		/* flag bits that must all be set */
+};
+
+typedef struct ffs_filter ffs_filter_t;
+
+typedef int (*ffs_iterate_fn)(ffs_entry_t *, void *);
+typedef int (*ffs_compare_fn)(off_t, size_t, void *);
+
+/*!
+ * @brief source and destination entry of a multi-entry copy or compare,
+ *        see __ffs_entries_copy() and __ffs_entries_compare()
+ */
+struct ffs_pair {
+    const char *src_name;	/* source entry name */
+    const char *dst_name;	/* destination entry name */
+    void *ctx;			/* compare callback context */
+    ssize_t rc;			/* bytes copied, or ranges that differ */
+    uint32_t written;		/* blocks written by the copy */
+    uint32_t skipped;		/* blocks skipped by the copy */
+};
+
+typedef struct ffs_pair ffs_pair_t;
+
+#define FFS_FILTER_ANY			0xFFFFFFFF
+
 #define FFS_PARTITION_NAME		"part"
 
 #define FFS_INFO_ERROR			0
@@ -74,6 +221,55 @@ typedef struct ffs_exception ffs_exception_t;
 #define FFS_INFO_BLOCK_SIZE		5
 #define FFS_INFO_BLOCK_COUNT		6
 #define FFS_INFO_OFFSET			8
+#define FFS_INFO_BLOCKS_WRITTEN		9
+#define FFS_INFO_BLOCKS_SKIPPED		10
+
+#define FFS_OPEN_LAZY			0x00000001
+
+#define FFS_COPY_DATA			0x00000001
+
+#define FFS_SYNC_NONE			0
+#define FFS_SYNC_BARRIER		1
+#define FFS_SYNC_WRITEBACK		2
+
+#define FFS_WRITEBACK_CHUNK		(8 << 20)
+#define FFS_COPY_BUFFER			(1 << 20)
+
+#define FFS_WRITE_ALWAYS		0
+#define FFS_WRITE_DIFF			1
+
+#define FFS_IO_PREAD			0
+#define FFS_IO_URING			1
+#define FFS_IO_DIRECT			2
+#define FFS_IO_DEPTH			32
+
+#define FFS_FIT_FIRST			0
+#define FFS_FIT_BEST			1
+
+/*!
+ * @brief accessors for the (big endian) entries of a mapped partition
+ *        table, see __ffs_mentry()
+ */
+#define FFS_MENTRY_FIELD(f)						\
+static inline uint32_t ffs_mentry_##f(const ffs_entry_t * e)		\
+{									\
+	return be32toh(e->f);						\
+}
+
+FFS_MENTRY_FIELD(base)
+FFS_MENTRY_FIELD(size)
+FFS_MENTRY_FIELD(pid)
+FFS_MENTRY_FIELD(id)
+FFS_MENTRY_FIELD(type)
+FFS_MENTRY_FIELD(flags)
+FFS_MENTRY_FIELD(actual)
+
+#undef FFS_MENTRY_FIELD
+
+static inline uint32_t ffs_mentry_user(const ffs_entry_t * e, uint32_t word)
+{
+	return be32toh(e->user.data[word]);
+}
 
 #define FFS_CHECK_PATH			-3
 #define FFS_CHECK_HEADER_MAGIC		-4
@@ -99,9 +295,21 @@ extern ffs_t * __ffs_create(const char *, off_t, uint32_t, uint32_t)
 extern ffs_t * __ffs_fopen(FILE *, off_t)
 /*! @cond */ __nonnull ((1)) /*! @endcond */ ;
 
+extern ffs_t * __ffs_fopen_flags(FILE *, off_t, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 extern ffs_t * __ffs_open(const char *, off_t)
 /*! @cond */ __nonnull ((1)) /*! @endcond */ ;
 
+extern ffs_t * __ffs_open_flags(const char *, off_t, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+extern ffs_t * __ffs_mopen(const char *, off_t)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+extern const ffs_entry_t * __ffs_mentry(ffs_t *, uint32_t)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 extern int __ffs_info(ffs_t *, int, uint32_t *)
 /*! @cond */ __nonnull ((1)) /*! @endcond */ ;
 
@@ -114,28 +322,72 @@ extern int __ffs_fclose(ffs_t *)
 extern int __ffs_fsync(ffs_t *)
 /*! @cond */ __nonnull ((1)) /*! @endcond */ ;
 
+extern int __ffs_sync_policy(ffs_t *, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+extern int __ffs_write_mode(ffs_t *, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+extern int __ffs_io_backend(ffs_t *, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+extern int __ffs_txn_begin(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+extern int __ffs_txn_commit(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+extern int __ffs_txn_abort(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 extern int __ffs_list_entries(ffs_t *, const char *, bool, FILE *)
 /*! @cond */ __nonnull ((1)) /*! @endcond */ ;
 
 extern int __ffs_iterate_entries(ffs_t *, int (*)(ffs_entry_t*))
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+extern int __ffs_iterate_entries_ctx(ffs_t *, const ffs_filter_t *,
+				     ffs_iterate_fn, void *)
+/*! @cond */ __nonnull ((1,3)) /*! @endcond */ ;
+
+extern int __ffs_verify_all(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 extern int __ffs_entry_find(ffs_t *, const char *, ffs_entry_t *)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
 extern int __ffs_entry_find_parent(ffs_t *, const char *, ffs_entry_t *)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+extern int __ffs_entry_find_by_offset(ffs_t *, off_t, ffs_entry_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 extern int __ffs_entry_name(ffs_t *, ffs_entry_t *, char *, size_t)
 /*! @cond */ __nonnull ((1,2,3)) /*! @endcond */ ;
 
+extern int __ffs_entry_match(ffs_t *, const char *, ffs_entry_t *)
+/*! @cond */ __nonnull ((1,2,3)) /*! @endcond */ ;
+
+extern int __ffs_reserve(ffs_t *, uint32_t)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 extern int __ffs_entry_add(ffs_t *, const char *, off_t,
 			    uint32_t, ffs_type_t, uint32_t)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+extern int __ffs_extent_alloc(ffs_t *, size_t, uint32_t, int, off_t *)
+/*! @cond */ __nonnull ((1,5)) /*! @endcond */ ;
+
+extern off_t __ffs_entry_add_auto(ffs_t *, const char *, uint32_t, uint32_t,
+				  int, ffs_type_t, uint32_t)
+/*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
+
 extern int __ffs_entry_delete(ffs_t *, const char *)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+extern int __ffs_entry_delete_tree(ffs_t *, const char *)
+/*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
+
 extern int __ffs_entry_user_get(ffs_t *, const char *, uint32_t, uint32_t *)
 /*! @cond */ __nonnull ((1,2,4)) /*! @endcond */ ;
 
@@ -155,12 +407,27 @@ extern ssize_t __ffs_entry_write(ffs_t *, const char *, const void *,
 				 off_t, size_t)
 /*! @cond */ __nonnull ((1,2,3)) /*! @endcond */ ;
 
-extern ssize_t __ffs_entry_copy(ffs_t *, ffs_t *, const char *)
-/*! @cond */ __nonnull ((1,2,3)) /*! @endcond */ ;
+extern ssize_t __ffs_entry_fill(ffs_t *, const char *, uint8_t)
+/*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
+
+extern ssize_t __ffs_entry_copy(ffs_t *, const char *, ffs_t *, const char *)
+/*! @cond */ __nonnull ((1,2,3,4)) /*! @endcond */ ;
+
+extern ssize_t __ffs_entry_copy_flags(ffs_t *, const char *, ffs_t *,
+				      const char *, int)
+/*! @cond */ __nonnull ((1,2,3,4)) /*! @endcond */ ;
 
-extern ssize_t __ffs_entry_compare(ffs_t *, ffs_t *, const char *)
+extern ssize_t __ffs_entry_compare(ffs_t *, const char *, ffs_t *,
+				   const char *, ffs_compare_fn, void *)
+/*! @cond */ __nonnull ((1,2,3,4,5)) /*! @endcond */ ;
+
+extern int __ffs_entries_copy(ffs_t *, ffs_t *, ffs_pair_t *, size_t, int)
 /*! @cond */ __nonnull ((1,2,3)) /*! @endcond */ ;
 
+extern int __ffs_entries_compare(ffs_t *, ffs_t *, ffs_pair_t *, size_t,
+				 ffs_compare_fn)
+/*! @cond */ __nonnull ((1,2,3,5)) /*! @endcond */ ;
+
 extern int __ffs_entry_list(ffs_t *, ffs_entry_t ** list)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
@@ -111,6 +111,49 @@ extern ffs_t * ffs_create(const char *, off_t, uint32_t, uint32_t)
 extern ffs_t * ffs_open(const char *, off_t)
 /*! @cond */ __nonnull ((1)) /*! @endcond */ ;
 
+/*!
+ * @brief Same as ffs_open(), with open 'flags'
+ * @memberof ffs
+ * @param path [in] Path of target file or device
+ * @param offset [in] Byte offset, from beginning of file (or device),
+ *        of the ffs_hdr_t structure
+ * @param flags [in] FFS_OPEN_LAZY - only check the header checksum, entry
+ *        checksums are checked when the entry is first looked up
+ * @return Pointer to ffs_t (allocated on the heap) on success,
+ *         NULL otherwise
+ */
+extern ffs_t * ffs_open_flags(const char *, off_t, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Map the file name 'path' read-only and open the @em FFS partition
+ *        table at 'offset' bytes from the beggining of the file, without
+ *        going through stdio.
+ * @memberof ffs
+ * @param path [in] Path of target file or block device
+ * @param offset [in] Byte offset, from beginning of file, of the ffs_hdr_t
+ *        structure
+ * @note The returned object can't be modified.  Checksums are verified on
+ *       the mapping and the entries are only decoded by the calls that need
+ *       them (lookups, listing, reads), ffs_mentry() never copies
+ * @return Pointer to ffs_t (allocated on the heap) on success,
+ *         NULL otherwise
+ */
+extern ffs_t * ffs_mopen(const char *, off_t)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Return the on-disk (big endian) partition entry 'index' of a
+ *        @em FFS object opened with ffs_mopen().  Use the ffs_mentry_*()
+ *        accessors to read its fields.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param index [in] Entry index, [0..FFS_INFO_ENTRY_COUNT)
+ * @return Pointer into the mapping on success, NULL otherwise
+ */
+extern const ffs_entry_t * ffs_mentry(ffs_t *, uint32_t)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 /*!
  * @brief Query a @em FFS object for header metadata.
  * @memberof ffs
@@ -122,6 +165,8 @@ extern ffs_t * ffs_open(const char *, off_t)
  * 		FFS_INFO_ENTRY_COUNT - ffs_hdr::entry_count
  * 		FFS_INFO_BLOCK_SIZE - ffs_hdr::block_size
  * 		FFS_INFO_BLOCK_COUNT - ffs_hdr::block_count
+ * 		FFS_INFO_BLOCKS_WRITTEN - blocks programmed by this object
+ * 		FFS_INFO_BLOCKS_SKIPPED - blocks left as they were
  * @param value [out] Pointer to output data
  * @return '0' on success, non-0 otherwise
  */
@@ -143,11 +188,106 @@ extern int ffs_close(ffs_t *)
  *        to the underlying file (or device).
  * @memberof ffs
  * @param self [in] Pointer to ffs object
+ * @note This is a durability barrier, see ffs_sync_policy().
  * @return '0' on success, non-0 otherwise
  */
 extern int ffs_fsync(ffs_t *)
 /*! @cond */ __nonnull ((1)) /*! @endcond */ ;
 
+/*!
+ * @brief Set the durability policy of a @em FFS object.  Writes are left
+ *        to the kernel's write-back and made durable at barriers only:
+ *        ffs_fsync(), the end of a partition table update and close.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param sync [in] FFS_SYNC_NONE (default, no fdatasync), FFS_SYNC_BARRIER
+ *        (fdatasync at each barrier) or FFS_SYNC_WRITEBACK (also start
+ *        write-back of coalesced data as it is written)
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_sync_policy(ffs_t *, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Set the write mode of a @em FFS object.  In FFS_WRITE_DIFF mode
+ *        partition data is read back before it is written and only the
+ *        blocks that differ are programmed.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param mode [in] FFS_WRITE_ALWAYS (default) or FFS_WRITE_DIFF
+ * @note Applies to ffs_entry_write(), ffs_entry_fill() and the destination
+ *       of ffs_entry_copy(), see ffs_info() for the block counts.
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_write_mode(ffs_t *, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Select the I/O backend of a @em FFS object.  FFS_IO_URING
+ *        submits batches of partition reads and writes through an
+ *        io_uring, if the kernel provides one.  FFS_IO_DIRECT reads and
+ *        writes partition data through a second descriptor opened with
+ *        O_DIRECT, bypassing the page cache for the block aligned part
+ *        of each transfer.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param backend [in] FFS_IO_PREAD (default), FFS_IO_URING or
+ *        FFS_IO_DIRECT
+ * @note Falls back to FFS_IO_PREAD, without an error, when io_uring is
+ *       not built in or not available at run-time, or when the image
+ *       cannot be reopened with O_DIRECT (e.g. a pipe, or a file system
+ *       without O_DIRECT support).
+ * @return Backend in use on success, '-1' otherwise
+ */
+extern int ffs_io_backend(ffs_t *, int)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Start a transaction on a @em FFS object.  Partition table edits
+ *        made until ffs_txn_commit() or ffs_txn_abort() are staged in
+ *        memory only.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @note Only the partition table is transactional, partition data written
+ *       with ffs_entry_write() goes to the file (or device) immediately.
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_txn_begin(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Check the staged partition table of a @em FFS object and write
+ *        it to the underlying file (or device) in one go.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @note If the check fails, the transaction stays open and the edits can
+ *       be dropped with ffs_txn_abort().
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_txn_commit(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Drop the partition table edits staged since ffs_txn_begin().
+ *        Closing a @em FFS object with a transaction in progress also
+ *        drops them.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_txn_abort(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Check the checksum of every entry of a @em FFS object, for
+ *        objects opened with FFS_OPEN_LAZY.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_verify_all(ffs_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 /*!
  * @brief Pretty print the entries of a @em FFS partition table to
  *        stream 'out'
@@ -172,6 +312,37 @@ extern int ffs_list_entries(ffs_t *, FILE *)
 extern int ffs_iterate_entries(ffs_t *, int (*)(ffs_entry_t*))
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+/*!
+ * @brief Iterate over the entries of a @em FFS partition table and
+ *        call a callback function 'func' with a caller context 'ctx'
+ * @note If the callback function returns non-0, the iteration function
+ *       will return that value immediately.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param func [in] Pointer the callback function
+ * @param ctx [in] Context pointer passed to each callback
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_iterate_entries_ctx(ffs_t *, ffs_iterate_fn, void *)
+/*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
+
+/*!
+ * @brief Iterate over the entries of a @em FFS partition table that
+ *        match 'filter' and call a callback function 'func'
+ * @note Entries that don't match the filter are skipped without calling
+ *       back.  Set the pid or type of the filter to FFS_FILTER_ANY to
+ *       match every entry, flags holds the bits that must all be set.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param filter [in] Pointer to the entry filter, or NULL
+ * @param func [in] Pointer the callback function
+ * @param ctx [in] Context pointer passed to each callback
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_iterate_entries_filter(ffs_t *, const ffs_filter_t *,
+				      ffs_iterate_fn, void *)
+/*! @cond */ __nonnull ((1,3)) /*! @endcond */ ;
+
 /*!
  * @brief Find an entry in a @em FFS partition table and return
  *        a copy of the in 'entry'
@@ -196,6 +367,33 @@ extern int ffs_entry_find(ffs_t *, const char *, ffs_entry_t *)
 extern int ffs_entry_find_parent(ffs_t *, const char *, ffs_entry_t *)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+/*!
+ * @brief Find the data partition entry of a @em FFS partition table that
+ *        contains byte 'offset' of the file (or device) and return a copy
+ *        of it in 'entry'
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param offset [in] Byte offset, from the beginning of the file (or device)
+ * @param entry [out] Target entry object (optional)
+ * @note Logical entries are never returned, the 'part' entry owns the
+ *       blocks of the partition table itself
+ * @return '1' == found, '0' == not-found, error otherwise
+ */
+extern int ffs_entry_find_by_offset(ffs_t *, off_t, ffs_entry_t *)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
+/*!
+ * @brief Make room for at least 'count' partition entries in a @em FFS
+ *        object, so that adding that many entries needs no further
+ *        allocation.
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param count [in] Number of partition entries
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_reserve(ffs_t *, uint32_t)
+/*! @cond */ __nonnull ((1)) /*! @endcond */ ;
+
 /*!
  * @brief Add a partition entry to a @em FFS partition table
  * @memberof ffs
@@ -217,6 +415,25 @@ extern int ffs_entry_find_parent(ffs_t *, const char *, ffs_entry_t *)
 extern int ffs_entry_add(ffs_t *, const char *, off_t, size_t, ffs_type_t, uint32_t)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+/*!
+ * @brief Add a data partition entry to a @em FFS partition table at
+ *        the first free (or best fitting) extent of the device
+ * @memberof ffs
+ * @param self [in] Pointer to ffs object
+ * @param path [in] Name of a partition entry
+ * @param size [in] Size, in bytes, of the partition entry
+ * @param align [in] Alignment, in bytes, of the partition entry offset
+ *        (a power of 2, rounded up to the block size)
+ * @param fit [in] Placement policy.  FFS_FIT_FIRST picks the lowest free
+ *        extent that is large enough, FFS_FIT_BEST the smallest one.
+ * @param type [in] Partition type, see ffs_entry_add()
+ * @param flags [in] Partition flags, see ffs_entry_add()
+ * @return Offset, in bytes, of the new entry on success, negative otherwise
+ */
+extern off_t ffs_entry_add_auto(ffs_t *, const char *, size_t, uint32_t,
+				int, ffs_type_t, uint32_t)
+/*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
+
 /*!
  * @brief Delete a partition entry from the @em FFS partition table
  * @memberof ffs
@@ -227,6 +444,17 @@ extern int ffs_entry_add(ffs_t *, const char *, off_t, size_t, ffs_type_t, uint3
 extern int ffs_entry_delete(ffs_t *, const char *)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+/*!
+ * @brief Delete a partition entry and all of its children from the @em FFS
+ *        partition table
+ * @memberof ffs
+ * @param self [in] Pointer to an ffs object
+ * @param path [in] Name of a partition entry
+ * @return '0' on success, non-0 otherwise
+ */
+extern int ffs_entry_delete_tree(ffs_t *, const char *)
+/*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
+
 /*!
  * @brief Get the value of a meta-data user word
  * @memberof ffs
@@ -314,11 +542,115 @@ extern ssize_t ffs_entry_read(ffs_t *, const char *, void *, off_t, size_t)
  * @param buf [in] Input data buffer
  * @param offset [in] Offset from the beginning of the partition
  * @param count [in] Number of bytes to write
+ * @note The actual size of the entry grows to 'offset' + the number of
+ *       bytes written, it is never reduced
  * @return Negative on failure, else number of bytes written otherwise
  */
 extern ssize_t ffs_entry_write(ffs_t *, const char *, const void *, off_t, size_t)
 /*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
 
+/*!
+ * @brief Fill the whole of partition entry 'name' with byte 'fill'
+ * @memberof ffs
+ * @param self [in] Pointer to an ffs object
+ * @param name [in] Name of a partition entry
+ * @param fill [in] Fill byte, e.g. 0xFF
+ * @note A zero fill of a regular file punches a hole instead of writing,
+ *       otherwise only the blocks that don't already hold the fill are
+ *       written.  The actual size of the entry is left unchanged.
+ * @return Negative on failure, else the size of the entry otherwise
+ */
+extern ssize_t ffs_entry_fill(ffs_t *, const char *, uint8_t)
+/*! @cond */ __nonnull ((1,2)) /*! @endcond */ ;
+
+/*!
+ * @brief Copy the data of partition entry 'src_name' to partition entry
+ *        'dst_name', possibly in another partition table or image
+ * @memberof ffs
+ * @param src [in] Pointer to the source ffs object
+ * @param src_name [in] Name of the source partition entry
+ * @param dst [in] Pointer to the destination ffs object
+ * @param dst_name [in] Name of the destination partition entry
+ * @note Between regular files the data is cloned or copied by the kernel
+ *       (copy_file_range), otherwise it is copied through a buffer.
+ * @return Negative on failure, else number of bytes copied otherwise
+ */
+extern ssize_t ffs_entry_copy(ffs_t *, const char *, ffs_t *, const char *)
+/*! @cond */ __nonnull ((1,2,3,4)) /*! @endcond */ ;
+
+/*!
+ * @brief Same as ffs_entry_copy(), with copy 'flags'
+ * @memberof ffs
+ * @param src [in] Pointer to the source ffs object
+ * @param src_name [in] Name of the source partition entry
+ * @param dst [in] Pointer to the destination ffs object
+ * @param dst_name [in] Name of the destination partition entry
+ * @param flags [in] FFS_COPY_DATA - copy the data only, the actual size
+ *        of the destination entry (the partition table) is left unchanged
+ * @note With FFS_COPY_DATA, copies into disjoint entries can run in
+ *       parallel, each through its own pair of ffs objects.
+ * @return Negative on failure, else number of bytes copied otherwise
+ */
+extern ssize_t ffs_entry_copy_flags(ffs_t *, const char *, ffs_t *,
+				    const char *, int)
+/*! @cond */ __nonnull ((1,2,3,4)) /*! @endcond */ ;
+
+/*!
+ * @brief Compare the data of two partition entries and call 'func' with
+ *        the offset and length of each range that differs
+ * @memberof ffs
+ * @param src [in] Pointer to the source ffs object
+ * @param src_name [in] Name of the source partition entry
+ * @param dst [in] Pointer to the destination ffs object
+ * @param dst_name [in] Name of the destination partition entry
+ * @param func [in] Callback, called in offset order
+ * @param ctx [in] Context pointer passed to each callback
+ * @note The source entry's data is compared, destination data past its
+ *       actual size is treated as different.  Differences less than
+ *       8 bytes apart are reported as one range.  If the callback
+ *       returns non-0, the comparison stops.
+ * @return Negative on failure, else number of ranges reported
+ */
+extern ssize_t ffs_entry_compare(ffs_t *, const char *, ffs_t *,
+				 const char *, ffs_compare_fn, void *)
+/*! @cond */ __nonnull ((1,2,3,4,5)) /*! @endcond */ ;
+
+/*!
+ * @brief Copy the data of several partition entries, same as calling
+ *        ffs_entry_copy_flags() for each pair in turn
+ * @memberof ffs
+ * @param src [in] Pointer to the source ffs object
+ * @param dst [in] Pointer to the destination ffs object
+ * @param pair [in,out] Array of entry name pairs, 'rc', 'written' and
+ *        'skipped' are set for each pair copied
+ * @param n [in] Number of pairs
+ * @param flags [in] Copy flags, see ffs_entry_copy_flags()
+ * @note With the io_uring backend, the reads (and then the writes) of
+ *       small entries are submitted together, up to FFS_IO_DEPTH
+ *       operations and FFS_COPY_BUFFER bytes per batch.
+ * @return 0 on success, negative otherwise
+ */
+extern int ffs_entries_copy(ffs_t *, ffs_t *, ffs_pair_t *, size_t, int)
+/*! @cond */ __nonnull ((1,2,3)) /*! @endcond */ ;
+
+/*!
+ * @brief Compare the data of several pairs of partition entries, same as
+ *        calling ffs_entry_compare() for each pair in turn
+ * @memberof ffs
+ * @param src [in] Pointer to the source ffs object
+ * @param dst [in] Pointer to the destination ffs object
+ * @param pair [in,out] Array of entry name pairs, 'ctx' is passed to
+ *        'func' and 'rc' is set to the number of ranges reported
+ * @param n [in] Number of pairs
+ * @param func [in] Callback, see ffs_entry_compare()
+ * @note With the io_uring backend, both sides of small entries are read
+ *       together, up to FFS_IO_DEPTH operations per batch.
+ * @return 0 on success, negative otherwise
+ */
+extern int ffs_entries_compare(ffs_t *, ffs_t *, ffs_pair_t *, size_t,
+			       ffs_compare_fn)
+/*! @cond */ __nonnull ((1,2,3,5)) /*! @endcond */ ;
+
 /*!
  * @brief Return an array of entry_t structures, one each partition that
  * 	exists in the partition table
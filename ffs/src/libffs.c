@@ -31,8 +31,15 @@
  *   Date: 05/07/12
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#undef VERSION			/* clashes with clib's VERSION() */
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
 #include <stdlib.h>
 #include <stdarg.h>
@@ -46,10 +53,19 @@
 #include <libgen.h>
 #include <regex.h>
 
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
 #include "libffs.h"
 
 #include <clib/builtin.h>
 #include <clib/checksum.h>
+#include <clib/hash.h>
 #include <clib/misc.h>
 #include <clib/err.h>
 #include <clib/raii.h>
@@ -66,81 +82,115 @@
 #endif
 
 #define FFS_ENTRY_EXTENT	10UL
+#define FFS_INDEX_MIN		64UL
 
 /* ============================================================ */
 
-static void __hdr_be32toh(ffs_hdr_t * hdr)
+/*
+ * The table is kept in host order, the on-flash (big endian) image is only
+ * produced in a separate wire buffer.  Byte swapping and checksumming are
+ * done in the same pass.  The checksum is the XOR of the big endian words
+ * preceding the checksum field, see memcpy_checksum().  Decoding may be
+ * done in place (i.e. 'hdr' == 'wire').
+ */
+#define __DECODE(f)	({ uint32_t __w = be32toh(wire->f);		\
+			   ck ^= __w, self->f = __w; })
+#define __ENCODE(f)	({ uint32_t __w = self->f;			\
+			   ck ^= __w, wire->f = htobe32(__w); })
+
+static uint32_t __hdr_decode(ffs_hdr_t * self, const ffs_hdr_t * wire)
 {
-	assert(hdr != NULL);
+	assert(self != NULL);
+	assert(wire != NULL);
+
+	uint32_t ck = memcpy_checksum(NULL, wire->resvd, sizeof(wire->resvd));
+
+	__DECODE(magic);
+	__DECODE(version);
+	__DECODE(size);
+	__DECODE(entry_size);
+	__DECODE(entry_count);
+	__DECODE(block_size);
+	__DECODE(block_count);
 
-	hdr->magic = be32toh(hdr->magic);
-	hdr->version = be32toh(hdr->version);
-	hdr->size = be32toh(hdr->size);
-	hdr->entry_size = be32toh(hdr->entry_size);
-	hdr->entry_count = be32toh(hdr->entry_count);
-	hdr->block_size = be32toh(hdr->block_size);
-	hdr->block_count = be32toh(hdr->block_count);
-	hdr->checksum = be32toh(hdr->checksum);
+	memmove(self->resvd, wire->resvd, sizeof(self->resvd));
+	self->checksum = be32toh(wire->checksum);
+
+	return ck;
 }
 
-static void __hdr_htobe32(ffs_hdr_t * hdr)
+static void __hdr_encode(ffs_hdr_t * wire, const ffs_hdr_t * self)
 {
-	assert(hdr != NULL);
+	assert(wire != NULL);
+	assert(self != NULL);
+
+	uint32_t ck = memcpy_checksum(wire->resvd, self->resvd,
+				      sizeof(wire->resvd));
 
-	hdr->magic = htobe32(hdr->magic);
-	hdr->version = htobe32(hdr->version);
-	hdr->size = htobe32(hdr->size);
-	hdr->entry_size = htobe32(hdr->entry_size);
-	hdr->entry_count = htobe32(hdr->entry_count);
-	hdr->block_size = htobe32(hdr->block_size);
-	hdr->block_count = htobe32(hdr->block_count);
-	hdr->checksum = htobe32(hdr->checksum);
+	__ENCODE(magic);
+	__ENCODE(version);
+	__ENCODE(size);
+	__ENCODE(entry_size);
+	__ENCODE(entry_count);
+	__ENCODE(block_size);
+	__ENCODE(block_count);
+
+	wire->checksum = htobe32(ck);
 }
 
-static void __entry_be32toh(ffs_entry_t * entry)
+static uint32_t __entry_decode(ffs_entry_t * self, const ffs_entry_t * wire)
 {
-	assert(entry != NULL);
+	assert(self != NULL);
+	assert(wire != NULL);
 
-	entry->base = be32toh(entry->base);
-	entry->size = be32toh(entry->size);
-	entry->pid = be32toh(entry->pid);
-	entry->id = be32toh(entry->id);
-	entry->type = be32toh(entry->type);
-	entry->flags = be32toh(entry->flags);
-	entry->actual = be32toh(entry->actual);
-	entry->checksum = be32toh(entry->checksum);
+	uint32_t ck = memcpy_checksum(NULL, wire->name, sizeof(wire->name));
+	memmove(self->name, wire->name, sizeof(self->name));
 
-	entry->resvd[0] = be32toh(entry->resvd[0]);
-	entry->resvd[1] = be32toh(entry->resvd[1]);
-	entry->resvd[2] = be32toh(entry->resvd[2]);
-	entry->resvd[3] = be32toh(entry->resvd[3]);
+	__DECODE(base);
+	__DECODE(size);
+	__DECODE(pid);
+	__DECODE(id);
+	__DECODE(type);
+	__DECODE(flags);
+	__DECODE(actual);
 
+	for (int j = 0; j < 4; j++)
+		__DECODE(resvd[j]);
 	for (int j = 0; j < FFS_USER_WORDS; j++)
-		entry->user.data[j] = be32toh(entry->user.data[j]);
+		__DECODE(user.data[j]);
+
+	self->checksum = be32toh(wire->checksum);
+
+	return ck;
 }
 
-static void __entry_htobe32(ffs_entry_t * entry)
+static void __entry_encode(ffs_entry_t * wire, const ffs_entry_t * self)
 {
-	assert(entry != NULL);
+	assert(wire != NULL);
+	assert(self != NULL);
 
-	entry->base = htobe32(entry->base);
-	entry->size = htobe32(entry->size);
-	entry->pid = htobe32(entry->pid);
-	entry->id = htobe32(entry->id);
-	entry->type = htobe32(entry->type);
-	entry->flags = htobe32(entry->flags);
-	entry->actual = htobe32(entry->actual);
-	entry->checksum = htobe32(entry->checksum);
+	uint32_t ck = memcpy_checksum(wire->name, self->name,
+				      sizeof(wire->name));
 
-	entry->resvd[0] = htobe32(entry->resvd[0]);
-	entry->resvd[1] = htobe32(entry->resvd[1]);
-	entry->resvd[2] = htobe32(entry->resvd[2]);
-	entry->resvd[3] = htobe32(entry->resvd[3]);
+	__ENCODE(base);
+	__ENCODE(size);
+	__ENCODE(pid);
+	__ENCODE(id);
+	__ENCODE(type);
+	__ENCODE(flags);
+	__ENCODE(actual);
 
+	for (int j = 0; j < 4; j++)
+		__ENCODE(resvd[j]);
 	for (int j = 0; j < FFS_USER_WORDS; j++)
-		entry->user.data[j] = htobe32(entry->user.data[j]);
+		__ENCODE(user.data[j]);
+
+	wire->checksum = htobe32(ck);
 }
 
+#undef __DECODE
+#undef __ENCODE
+
 static int __hdr_read(ffs_hdr_t * hdr, FILE * file, off_t offset)
 {
 	assert(hdr != NULL);
@@ -156,10 +206,7 @@ static int __hdr_read(ffs_hdr_t * hdr, FILE * file, off_t offset)
 		return -1;
 	}
 
-	uint32_t ck = memcpy_checksum(NULL, (void *)hdr,
-				      offsetof(ffs_hdr_t, checksum));
-
-	__hdr_be32toh(hdr);
+	uint32_t ck = __hdr_decode(hdr, hdr);
 
 	if (hdr->magic != FFS_MAGIC) {
 		ERROR(ERR_UNEXPECTED, FFS_CHECK_HEADER_MAGIC,
@@ -178,1320 +225,4628 @@ static int __hdr_read(ffs_hdr_t * hdr, FILE * file, off_t offset)
 	return 0;
 }
 
-static int __hdr_write(ffs_hdr_t * hdr, FILE * file, off_t offset)
+static int __bitmap_set(uint32_t ** map, uint32_t * map_size, uint32_t start,
+			uint32_t end)
 {
-	assert(hdr != NULL);
-	assert(hdr->magic == FFS_MAGIC);
+	assert(map != NULL);
+	assert(map_size != NULL);
 
-	hdr->checksum = memcpy_checksum(NULL, (void *)hdr,
-					offsetof(ffs_hdr_t, checksum));
-	hdr->checksum = htobe32(hdr->checksum);
+	if (*map_size < end) {
+		uint32_t size = align(end, 32);
 
-	if (fseeko(file, offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
+		uint32_t *__map = (uint32_t *)realloc(*map, size / 8);
+		if (__map == NULL) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		memset(__map + *map_size / 32, 0, (size - *map_size) / 8);
+
+		*map = __map;
+		*map_size = size;
 	}
 
-	size_t size = sizeof(*hdr);
+	for (uint32_t i = start; i < end; i++)
+		(*map)[i / 32] |= 1U << (i % 32);
 
-	if (0 < hdr->entry_count) {
-		size += hdr->entry_count * hdr->entry_size;
+	return 0;
+}
 
-		for (size_t i=0; i<hdr->entry_count; i++) {
-			ffs_entry_t *e = hdr->entries + i;
+static bool __bitmap_test(const uint32_t * map, uint32_t map_size,
+			  uint32_t i)
+{
+	return i < map_size && (map[i / 32] & (1U << (i % 32)));
+}
 
-			__entry_htobe32(e);
+/*
+ * Entries changed since the last flush are tracked in a bitmap indexed like
+ * hdr->entries, so a flush only rewrites those 128 byte records (and the
+ * header) instead of the whole table.
+ */
+static int __entries_dirty(ffs_t * self, uint32_t start, uint32_t end)
+{
+	assert(self != NULL);
 
-			e->checksum = memcpy_checksum(NULL, (void *)e,
-						      offsetof(ffs_entry_t,
-							       checksum));
-			e->checksum = htobe32(e->checksum);
-		}
-	}
+	if (__bitmap_set(&self->dirty_map, &self->dirty_size, start, end) < 0)
+		return -1;
+
+	self->dirty = true;
 
-	__hdr_htobe32(hdr);
+	return 0;
+}
 
-	size_t rc = fwrite(hdr, 1, size, file);
-	if (rc <= 0 && ferror(file)) {
-		ERRNO(errno);
+/*
+ * With FFS_OPEN_LAZY only the header checksum is checked at open time.  An
+ * entry checksum is checked the first time the entry is looked up, good
+ * entries (and entries created since) are remembered in a bitmap indexed
+ * like hdr->entries.
+ */
+static int __entry_check(ffs_t * self, ffs_entry_t * entry)
+{
+	assert(self != NULL);
+	assert(entry != NULL);
+
+	uint32_t i = entry - self->hdr->entries;
+
+	if (self->lazy == false ||
+	    __bitmap_test(self->valid_map, self->valid_size, i))
+		return 0;
+
+	ffs_entry_t wire;
+	__entry_encode(&wire, entry);
+
+	uint32_t ck = be32toh(wire.checksum);
+
+	if (entry->checksum != ck) {
+		ERROR(ERR_UNEXPECTED, FFS_CHECK_ENTRY_CHECKSUM,
+		      "'%.*s' entry checksum mismatch '%x' != '%x'",
+		      (int)sizeof(entry->name), entry->name,
+		      entry->checksum, ck);
 		return -1;
 	}
 
-	__hdr_be32toh(hdr);
-	if (0 < hdr->entry_count)
-		for (size_t i=0; i<hdr->entry_count; i++)
-			__entry_be32toh(hdr->entries + i);
+	return __bitmap_set(&self->valid_map, &self->valid_size, i, i + 1);
+}
 
-	return 0;
+static int __entry_dirty(ffs_t * self, ffs_entry_t * entry)
+{
+	assert(self != NULL);
+	assert(entry != NULL);
+
+	uint32_t i = entry - self->hdr->entries;
+
+	return __entries_dirty(self, i, i + 1);
 }
 
-static int __entries_read(ffs_hdr_t * hdr, FILE * file, off_t offset)
+/*
+ * Positional I/O on the underlying descriptor, so that readers and writers
+ * never share (or move) the stream's file position.  Streams without a
+ * descriptor fall back to stdio.
+ */
+static ssize_t __read_at(FILE * file, void * buf, size_t size, off_t offset)
 {
-	assert(hdr != NULL);
-	assert(hdr->magic == FFS_MAGIC);
+	assert(file != NULL);
+	assert(buf != NULL);
 
-	if (0 < hdr->entry_count) {
+	int fd = fileno(file);
+	size_t total = 0;
+
+	if (fd < 0) {
 		if (fseeko(file, offset, SEEK_SET) != 0) {
 			ERRNO(errno);
 			return -1;
 		}
 
-		size_t size = hdr->entry_count * hdr->entry_size;
-
-		size_t rc = fread(hdr->entries, 1, size, file);
-		if (rc <= 0 && ferror(file)) {
+		total = fread(buf, 1, size, file);
+		if (total < size && ferror(file)) {
 			ERRNO(errno);
 			return -1;
 		}
 
-		for (size_t i=0; i<hdr->entry_count; i++) {
-			ffs_entry_t *e = hdr->entries + i;
-
-			uint32_t ck = memcpy_checksum(NULL, (void *)e,
-                                                      offsetof(ffs_entry_t,
-							      checksum));
-			__entry_be32toh(e);
+		return total;
+	}
 
-			if (e->checksum != ck) {
-				ERROR(ERR_UNEXPECTED, FFS_CHECK_ENTRY_CHECKSUM,
-				      "'%s' entry checksum mismatch '%x' != "
-				      "'%x'", e->name, e->checksum, ck);
-				return -1;
-			}
+	while (total < size) {
+		ssize_t rc = pread(fd, (char *)buf + total, size - total,
+				   offset + total);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			ERRNO(errno);
+			return -1;
 		}
+		if (rc == 0)
+			break;
+
+		total += rc;
 	}
 
-	return 0;
+	return total;
 }
 
-#if 0
-static void __entries_write(ffs_hdr_t * hdr, FILE * file, off_t offset)
+static int __write_at(FILE * file, const void * buf, size_t size,
+		      off_t offset)
 {
-	if (hdr == NULL)
-		ffs_throw(UNEX, 10400, "NULL hdr pointer");
-	if (hdr->magic != FFS_MAGIC)
-		ffs_throw(UNEX, 10401, "magic number mismatch '%x' != "
-			  "'%x'", hdr->magic, FFS_MAGIC);
+	assert(file != NULL);
+	assert(buf != NULL);
 
-	if (0 < hdr->entry_count) {
-		size_t size = hdr->entry_count * hdr->entry_size;
+	int fd = fileno(file);
 
-		for (size_t i = 0; i < hdr->entry_count; i++) {
-			ffs_entry_t *e = hdr->entries + i;
-			__entry_htobe32(e);
-			e->checksum = memcpy_checksum(NULL, (void *)e,
-						      offsetof(ffs_entry_t,
-							       checksum));
-			e->checksum = htobe32(e->checksum);
+	if (fd < 0) {
+		if (fseeko(file, offset, SEEK_SET) != 0) {
+			ERRNO(errno);
+			return -1;
 		}
 
-		if (fseeko(file, offset, SEEK_SET) != 0)
-			ffs_throw(ERR, 10402, "%s (errno=%d)",
-				  strerror(errno), errno);
-
-		size_t rc = fwrite(hdr->entries, 1, size, file);
-		if (rc <= 0 && ferror(file))
-			ffs_throw(ERR, 10403, "%s (errno=%d)",
-			  	  strerror(errno), errno);
-
-		fflush(file);
+		if (fwrite(buf, 1, size, file) != size) {
+			ERRNO(errno);
+			return -1;
+		}
 
-		for (size_t i = 0; i < hdr->entry_count; i++)
-			__entry_be32toh(hdr->entries + i);
+		return 0;
 	}
-}
-#endif
 
-static ffs_entry_t *__iterate_entries(ffs_hdr_t * self,
-				      int (*func) (ffs_entry_t *))
-{
-	assert(self != NULL);
-	assert(func != NULL);
+	while (0 < size) {
+		ssize_t rc = pwrite(fd, buf, size, offset);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			ERRNO(errno);
+			return -1;
+		}
 
-	for (uint32_t i = 0; i < self->entry_count; i++) {
-		if (func(self->entries + i) != 0)
-			return self->entries + i;
+		buf = (const char *)buf + rc;
+		size -= rc;
+		offset += rc;
 	}
 
-	return NULL;
+	return 0;
 }
 
-static ffs_entry_t *__find_entry(ffs_hdr_t * self, const char *path)
+/*
+ * O_DIRECT.  A handle in FFS_IO_DIRECT mode reads and writes its partition
+ * data through a second descriptor opened with O_DIRECT, so streaming a
+ * large image leaves the page cache alone.  The part of a transfer that
+ * is aligned to 'align' (the larger of the block size and the page size,
+ * both powers of two) goes direct, through an aligned bounce buffer
+ * unless the caller's buffer is aligned as well; an unaligned head or
+ * tail goes through the buffered descriptor.
+ *
+ * In the other modes the kernel is told that data is streamed and, once
+ * a barrier has made it durable or it has been read, that the cached
+ * pages can go.
+ */
+static void __advise(ffs_t * self, off_t offset, size_t size, int advice)
 {
-	assert(self != NULL);
+	int fd = fileno(self->file);
 
-	if (path == NULL || *path == '\0')
-		return NULL;
+	if (self->io != FFS_IO_DIRECT && 0 <= fd)
+		(void)posix_fadvise(fd, offset, size, advice);
+}
 
-	if (*path == '/')
-		path++;
+static void __direct_close(ffs_t * self)
+{
+	if (self->io == FFS_IO_DIRECT)
+		close(self->direct), self->direct = -1;
+}
 
-	char __path[strlen(path) + 1];
-	strcpy(__path, path);
-	path = __path;
+static bool __direct_open(ffs_t * self)
+{
+	int fd = fileno(self->file);
+	if (fd < 0)
+		return false;
 
-	ffs_entry_t root = {.id = FFS_PID_TOPLEVEL }, *parent = &root;
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return false;
 
-	char *name;
-	while (parent != NULL && (name = strtok((char *)path, "/")) != NULL) {
-		path = NULL;
+	char path[PATH_MAX];
+	snprintf(path, sizeof path, "/proc/self/fd/%d", fd);
 
-		int find_entry(ffs_entry_t * child) {
-			return (parent->id == child->pid &&
-				strncmp(name, child->name,
-					sizeof(child->name)) == 0);
-		}
+	int direct = open(path, (flags & O_ACCMODE) | O_DIRECT | O_CLOEXEC);
+	if (direct < 0)
+		return false;
 
-		parent = __iterate_entries(self, find_entry);
-	}
+	self->direct = direct;
+	self->align = max((size_t)self->hdr->block_size,
+			  (size_t)sysconf(_SC_PAGESIZE));
 
-	return parent;
+	return true;
 }
 
-/* ============================================================ */
-
-int __ffs_fcheck(FILE *file, off_t offset)
+/* returns bytes transferred, short only at EOF */
+static ssize_t __direct_range(ffs_t * self, bool write, char *buf,
+			      size_t size, off_t offset)
 {
-	assert(file != NULL);
-
-	RAII(ffs_hdr_t*, hdr, malloc(sizeof(*hdr)), free);
-	if (hdr == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-	memset(hdr, 0, sizeof(*hdr));
+	RAII(void *, bounce, NULL, free);
+	size_t chunk = size;
 
-	if (fseeko(file, offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
+	if ((uintptr_t)buf % self->align != 0) {
+		chunk = min(size, max((size_t)FFS_COPY_BUFFER, self->align));
+		chunk -= chunk % self->align;
 
-	if (fread(hdr, 1, sizeof(*hdr), file) <= 0 && ferror(file)) {
-		ERRNO(errno);
-		return -1;
+		if (posix_memalign(&bounce, self->align, chunk) != 0) {
+			ERRNO(ENOMEM);
+			return -1;
+		}
 	}
 
-	uint32_t ck = memcpy_checksum(NULL, (void *)hdr,
-				      offsetof(ffs_hdr_t, checksum));
-	__hdr_be32toh(hdr);
-
-	if (hdr->magic != FFS_MAGIC) {
-		ERROR(ERR_UNEXPECTED, FFS_CHECK_HEADER_MAGIC,
-		      "header magic mismatch '%x' != '%x'",
-		      hdr->magic, FFS_MAGIC);
-		return FFS_CHECK_HEADER_MAGIC;
-	}
-	if (hdr->checksum != ck) {
-		ERROR(ERR_UNEXPECTED, FFS_CHECK_HEADER_CHECKSUM,
-		      "header checksum mismatch '%x' != '%x'",
-		      hdr->checksum, ck);
-	 	return FFS_CHECK_HEADER_CHECKSUM;
-	}
+	size_t total = 0;
 
-	size_t size = hdr->entry_count * hdr->entry_size;
+	while (total < size) {
+		size_t n = min(chunk, size - total);
+		char *p = bounce != NULL ? bounce : buf + total;
 
-	hdr = (ffs_hdr_t *)realloc(hdr, sizeof(*hdr) + size);
-	if (hdr == NULL) {
-		ERRNO(errno);
-		return -1;
-	}
-	memset(hdr->entries, 0, size);
+		if (write && bounce != NULL)
+			memcpy(p, buf + total, n);
 
-	if (0 < hdr->entry_count) {
-		if (fread(hdr->entries, 1, size, file) <= 0 && ferror(file)) {
+		ssize_t rc = write ?
+		    pwrite(self->direct, p, n, offset + total) :
+		    pread(self->direct, p, n, offset + total);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			/* not every file system takes every alignment */
+			if (errno == EINVAL)
+				break;
 			ERRNO(errno);
 			return -1;
 		}
+		if (rc == 0)
+			return total;
 
-		for (size_t i = 0; i < hdr->entry_count; i++) {
-			ffs_entry_t *e = hdr->entries + i;
+		if (!write && bounce != NULL)
+			memcpy(buf + total, p, rc);
 
-			uint32_t ck = memcpy_checksum(NULL, (void *)e,
-						      offsetof(ffs_entry_t,
-							      checksum));
+		total += rc;
+	}
 
-			__entry_be32toh(e);
+	if (total < size) {
+		if (write)
+			return __write_at(self->file, buf + total, size - total,
+					  offset + total) < 0 ? -1 : (ssize_t)size;
 
-			if (e->checksum != ck) {
-				ERROR(ERR_UNEXPECTED, FFS_CHECK_ENTRY_CHECKSUM,
-				      "'%s' entry checksum mismatch '%x' != "
-				      "'%x'", e->name, e->checksum, ck);
-				return FFS_CHECK_ENTRY_CHECKSUM;
-			}
-		}
+		ssize_t rc = __read_at(self->file, buf + total, size - total,
+				       offset + total);
+		return rc < 0 ? -1 : (ssize_t)(total + rc);
 	}
 
-	return 0;
+	return total;
 }
 
-int __ffs_check(const char *path, off_t offset)
+static ssize_t __direct_io(ffs_t * self, bool write, void *buf, size_t size,
+			   off_t offset)
 {
-	if (path == NULL || *path == '\0') {
-		UNEXPECTED("invalid path '%s'\n", path);
-		return -1;
+	off_t mask = self->align - 1;
+	off_t end = offset + size;
+	off_t lo = min((offset + mask) & ~mask, end);
+	off_t hi = max(end & ~mask, lo);
+
+	ssize_t total = 0;
+
+	if (offset < lo) {
+		if (write) {
+			if (__write_at(self->file, buf, lo - offset,
+				       offset) < 0)
+				return -1;
+			total = lo - offset;
+		} else {
+			total = __read_at(self->file, buf, lo - offset,
+					  offset);
+			if (total < lo - offset)
+				return total;
+		}
 	}
 
-	RAII(FILE*, file, fopen(path, "r"), fclose);
-	if (file == NULL) {
-		ERRNO(errno);
-		return -1;
+	if (lo < hi) {
+		ssize_t rc = __direct_range(self, write, (char *)buf + total,
+					    hi - lo, lo);
+		if (rc < 0)
+			return -1;
+		total += rc;
+		if (rc < hi - lo)
+			return total;
 	}
 
-	return __ffs_fcheck(file, offset);
+	if (hi < end) {
+		if (write) {
+			if (__write_at(self->file, (char *)buf + total,
+				       end - hi, hi) < 0)
+				return -1;
+			total += end - hi;
+		} else {
+			ssize_t rc = __read_at(self->file, (char *)buf + total,
+					       end - hi, hi);
+			if (rc < 0)
+				return -1;
+			total += rc;
+		}
+	}
+
+	return total;
 }
 
-ffs_t *__ffs_fcreate(FILE *file, off_t offset, uint32_t block_size,
-		     uint32_t block_count)
+static ssize_t __data_read(ffs_t * self, FILE * file, void *buf, size_t size,
+			   off_t offset)
+{
+	if (self->io == FFS_IO_DIRECT && file == self->file)
+		return __direct_io(self, false, buf, size, offset);
+
+	return __read_at(file, buf, size, offset);
+}
+
+static int __data_write(ffs_t * self, FILE * file, const void *buf,
+			size_t size, off_t offset)
+{
+	if (self->io == FFS_IO_DIRECT && file == self->file)
+		return __direct_io(self, true, (void *)buf, size,
+				   offset) < 0 ? -1 : 0;
+
+	return __write_at(file, buf, size, offset);
+}
+
+/*
+ * Batched I/O.  A batch is a set of independent positional reads and
+ * writes; with the io_uring backend the whole batch is submitted and
+ * reaped with one io_uring_enter() per FFS_IO_DEPTH operations, with the
+ * default backend (or whenever the ring is not available) it is a loop of
+ * __read_at() / __write_at().  Reads report how much they read, writes
+ * either complete or fail.  Short transfers and transient errors from the
+ * ring are finished synchronously.
+ */
+struct __io {
+	FILE *file;
+	bool write;
+	void *buf;
+	size_t size;
+	off_t offset;
+	ssize_t done;
+};
+
+#ifdef HAVE_LINUX_IO_URING_H
+struct ffs_ring {
+	int fd;
+
+	void *sq;
+	size_t sq_size;
+	void *cq;
+	size_t cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static void __ring_free(ffs_t * self)
+{
+	ffs_ring_t *ring = self->ring;
+	if (ring == NULL)
+		return;
+
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq != NULL && ring->cq != MAP_FAILED && ring->cq != ring->sq)
+		munmap(ring->cq, ring->cq_size);
+	if (ring->sq != NULL && ring->sq != MAP_FAILED)
+		munmap(ring->sq, ring->sq_size);
+	if (0 <= ring->fd)
+		close(ring->fd);
+
+	free(ring), self->ring = NULL;
+}
+
+static bool __ring_probe(int fd)
+{
+	size_t size = sizeof(struct io_uring_probe) +
+	    IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+
+	RAII(struct io_uring_probe *, probe, calloc(1, size), free);
+	if (probe == NULL)
+		return false;
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+		    probe, IORING_OP_LAST) < 0)
+		return false;
+
+	return IORING_OP_WRITE <= probe->last_op &&
+	    (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+	    (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+}
+
+/* returns false, without an error, when the kernel can't provide a ring */
+static bool __ring_init(ffs_t * self)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof p);
+
+	int fd = syscall(__NR_io_uring_setup, FFS_IO_DEPTH, &p);
+	if (fd < 0)
+		return false;
+
+	ffs_ring_t *ring = calloc(1, sizeof(*ring));
+	if (ring == NULL) {
+		close(fd);
+		return false;
+	}
+	ring->fd = fd;
+	self->ring = ring;
+
+	if (__ring_probe(fd) == false)
+		goto fail;
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_size = ring->cq_size = max(ring->sq_size,
+						    ring->cq_size);
+
+	ring->sq = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sq == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq = ring->sq;
+	else
+		ring->cq = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd,
+				IORING_OFF_CQ_RING);
+	if (ring->cq == MAP_FAILED)
+		goto fail;
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail;
+
+	ring->sq_head = (unsigned *)((char *)ring->sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq + p.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq +
+					     p.cq_off.cqes);
+
+	return true;
+
+fail:
+	__ring_free(self);
+	return false;
+}
+
+/* submit up to FFS_IO_DEPTH operations and wait for all of them */
+static int __ring_submit(ffs_ring_t * ring, struct __io *op, size_t n)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned mask = *ring->sq_mask;
+
+	for (size_t i = 0; i < n; i++, tail++) {
+		unsigned idx = tail & mask;
+		struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = op[i].write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = fileno(op[i].file);
+		sqe->addr = (uintptr_t)op[i].buf;
+		sqe->len = op[i].size;
+		sqe->off = op[i].offset;
+		sqe->user_data = i;
+
+		ring->sq_array[idx] = idx;
+		op[i].done = -EINPROGRESS;
+	}
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	size_t submit = n, left = n;
+	while (0 < left) {
+		long rc = syscall(__NR_io_uring_enter, ring->fd, submit, left,
+				  IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			ERRNO(errno);
+			return -1;
+		}
+		submit -= min((size_t)rc, submit);
+
+		unsigned head = *ring->cq_head;
+		unsigned end = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+		for (; head != end; head++) {
+			struct io_uring_cqe *cqe;
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			op[cqe->user_data].done = cqe->res;
+			left--;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+#else
+struct ffs_ring {
+	int fd;
+};
+
+static void __ring_free(ffs_t * self)
+{
+	free(self->ring), self->ring = NULL;
+}
+
+static bool __ring_init(ffs_t * self)
+{
+	return false;
+}
+
+static int __ring_submit(ffs_ring_t * ring, struct __io *op, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		op[i].done = -EINPROGRESS;
+
+	return 0;
+}
+#endif
+
+static int __io_submit(ffs_t * self, struct __io *op, size_t n)
+{
+	assert(self != NULL);
+
+	for (size_t i = 0; i < n; i += FFS_IO_DEPTH) {
+		size_t count = min(n - i, (size_t)FFS_IO_DEPTH);
+
+		if (self->ring == NULL || count == 1) {
+			for (size_t j = i; j < i + count; j++)
+				op[j].done = -EINPROGRESS;
+		} else if (__ring_submit(self->ring, op + i, count) < 0) {
+			return -1;
+		}
+
+		for (size_t j = i; j < i + count; j++) {
+			ssize_t done = op[j].done;
+
+			/* finish whatever the ring didn't */
+			if (done < 0 && done != -EINPROGRESS &&
+			    done != -EINTR && done != -EAGAIN) {
+				ERRNO((int)-done);
+				return -1;
+			}
+			if (done < 0)
+				done = 0;
+			if ((size_t)done == op[j].size) {
+				op[j].done = done;
+				continue;
+			}
+
+			char *buf = (char *)op[j].buf + done;
+			size_t size = op[j].size - done;
+			off_t offset = op[j].offset + done;
+
+			if (op[j].write) {
+				if (__data_write(self, op[j].file, buf, size,
+					       offset) < 0)
+					return -1;
+				op[j].done = op[j].size;
+			} else {
+				ssize_t rc = __data_read(self, op[j].file, buf, size,
+						       offset);
+				if (rc < 0)
+					return -1;
+				op[j].done = done + rc;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static bool __entry_is_dirty(ffs_t * self, uint32_t i)
+{
+	assert(self != NULL);
+
+	return __bitmap_test(self->dirty_map, self->dirty_size, i);
+}
+
+/*
+ * Serialize the dirty entries into the wire buffer and write each run of
+ * adjacent records with one positional write.  The header goes last,
+ * together with any run of dirty records that immediately follows it.
+ */
+static int __hdr_write(ffs_t * self)
+{
+	assert(self != NULL);
+
+	ffs_hdr_t *hdr = self->hdr;
+	assert(hdr->magic == FFS_MAGIC);
+
+	size_t size = sizeof(*hdr) + hdr->entry_count * hdr->entry_size;
+
+	if (self->wire_size < size) {
+		void *wire = realloc(self->wire, size);
+		if (wire == NULL) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		self->wire = wire;
+		self->wire_size = size;
+	}
+
+	ffs_hdr_t *wire = self->wire;
+
+	/* drop stdio buffers, the records are written under them */
+	if (fflush(self->file) != 0) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	uint32_t lead = 0;
+	while (lead < hdr->entry_count && __entry_is_dirty(self, lead)) {
+		__entry_encode(wire->entries + lead, hdr->entries + lead);
+		lead++;
+	}
+
+	for (uint32_t i = lead; i < hdr->entry_count; i++) {
+		if (__entry_is_dirty(self, i) == false)
+			continue;
+
+		uint32_t start = i;
+		for (; i < hdr->entry_count && __entry_is_dirty(self, i); i++)
+			__entry_encode(wire->entries + i, hdr->entries + i);
+
+		if (__write_at(self->file, wire->entries + start,
+			       (i - start) * hdr->entry_size,
+			       self->offset + sizeof(*hdr) +
+			       start * hdr->entry_size) < 0)
+			return -1;
+	}
+
+	__hdr_encode(wire, hdr);
+
+	if (__write_at(self->file, wire, sizeof(*hdr) +
+		       lead * hdr->entry_size, self->offset) < 0)
+		return -1;
+
+	if (self->dirty_map != NULL)
+		memset(self->dirty_map, 0, self->dirty_size / 8);
+
+	return 0;
+}
+
+static int __entries_read(ffs_hdr_t * hdr, FILE * file, off_t offset,
+			  bool lazy)
+{
+	assert(hdr != NULL);
+	assert(hdr->magic == FFS_MAGIC);
+
+	if (0 < hdr->entry_count) {
+		if (fseeko(file, offset, SEEK_SET) != 0) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		size_t size = hdr->entry_count * hdr->entry_size;
+
+		size_t rc = fread(hdr->entries, 1, size, file);
+		if (rc <= 0 && ferror(file)) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		for (size_t i=0; i<hdr->entry_count; i++) {
+			ffs_entry_t *e = hdr->entries + i;
+
+			uint32_t ck = __entry_decode(e, e);
+
+			if (lazy == false && e->checksum != ck) {
+				ERROR(ERR_UNEXPECTED, FFS_CHECK_ENTRY_CHECKSUM,
+				      "'%s' entry checksum mismatch '%x' != "
+				      "'%x'", e->name, e->checksum, ck);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+#if 0
+static void __entries_write(ffs_hdr_t * hdr, FILE * file, off_t offset)
+{
+	if (hdr == NULL)
+		ffs_throw(UNEX, 10400, "NULL hdr pointer");
+	if (hdr->magic != FFS_MAGIC)
+		ffs_throw(UNEX, 10401, "magic number mismatch '%x' != "
+			  "'%x'", hdr->magic, FFS_MAGIC);
+
+	if (0 < hdr->entry_count) {
+		size_t size = hdr->entry_count * hdr->entry_size;
+
+		for (size_t i = 0; i < hdr->entry_count; i++) {
+			ffs_entry_t *e = hdr->entries + i;
+			__entry_htobe32(e);
+			e->checksum = memcpy_checksum(NULL, (void *)e,
+						      offsetof(ffs_entry_t,
+							       checksum));
+			e->checksum = htobe32(e->checksum);
+		}
+
+		if (fseeko(file, offset, SEEK_SET) != 0)
+			ffs_throw(ERR, 10402, "%s (errno=%d)",
+				  strerror(errno), errno);
+
+		size_t rc = fwrite(hdr->entries, 1, size, file);
+		if (rc <= 0 && ferror(file))
+			ffs_throw(ERR, 10403, "%s (errno=%d)",
+			  	  strerror(errno), errno);
+
+		fflush(file);
+
+		for (size_t i = 0; i < hdr->entry_count; i++)
+			__entry_be32toh(hdr->entries + i);
+	}
+}
+#endif
+
+static inline bool __filter_match(const ffs_filter_t * filter,
+				  const ffs_entry_t * e)
+{
+	if (filter == NULL)
+		return true;
+
+	return (filter->pid == FFS_FILTER_ANY || filter->pid == e->pid) &&
+	       (filter->type == FFS_FILTER_ANY || filter->type == e->type) &&
+	       (e->flags & filter->flags) == filter->flags;
+}
+
+static ffs_entry_t *__iterate_entries(ffs_hdr_t * self,
+				      const ffs_filter_t * filter,
+				      ffs_iterate_fn func, void *ctx)
+{
+	assert(self != NULL);
+	assert(func != NULL);
+
+	for (uint32_t i = 0; i < self->entry_count; i++) {
+		ffs_entry_t *e = self->entries + i;
+
+		if (e->type == 0 || __filter_match(filter, e) == false)
+			continue;
+		if (func(e, ctx) != 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+/*
+ * (pid, name) -> entry hash index.  Open addressing with linear probing,
+ * each slot holds 'entry index + 1' so that 0 marks an empty slot.  The
+ * table is kept at most half full and is sized against the entry array
+ * capacity, so it only needs rebuilding when the array is reshaped.
+ */
+static uint32_t __index_hash(uint32_t pid, const char *name, size_t len)
+{
+	uint32_t hash = 2166136261U;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619U;
+	}
+
+	return hash ^ (uint32_t)int64_hash1(pid);
+}
+
+static void __index_insert(ffs_t * self, uint32_t i)
+{
+	assert(self != NULL);
+	assert(self->index != NULL);
+
+	ffs_entry_t *e = self->hdr->entries + i;
+	uint32_t mask = self->index_size - 1;
+
+	uint32_t slot = __index_hash(e->pid, e->name,
+				     strnlen(e->name, sizeof(e->name))) & mask;
+	while (self->index[slot] != 0)
+		slot = (slot + 1) & mask;
+
+	self->index[slot] = i + 1;
+	self->index_used++;
+}
+
+/*
+ * parent -> children links, kept next to the hash index and indexed like
+ * hdr->entries.  'child' holds the first child and 'sibling' the next
+ * child of the same parent, both as 'entry index + 1'.
+ */
+static void __tree_link(ffs_t * self, uint32_t i, uint32_t p)
+{
+	assert(self != NULL);
+
+	self->parent[i] = p + 1;
+	self->sibling[i] = self->child[p];
+	self->child[p] = i + 1;
+}
+
+static void __tree_unlink(ffs_t * self, uint32_t i)
+{
+	assert(self != NULL);
+
+	if (self->parent[i] == 0)
+		return;
+
+	uint32_t *link = &self->child[self->parent[i] - 1];
+	while (*link != 0 && *link != i + 1)
+		link = &self->sibling[*link - 1];
+
+	if (*link != 0)
+		*link = self->sibling[i];
+
+	self->parent[i] = self->sibling[i] = 0;
+}
+
+static int __index_build(ffs_t * self)
+{
+	assert(self != NULL);
+
+	uint32_t size = FFS_INDEX_MIN;
+	while (size < self->count * 2)
+		size <<= 1;
+
+	if (size != self->index_size) {
+		uint32_t *index = realloc(self->index, size * sizeof(*index));
+		if (index == NULL) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		self->index = index;
+		self->index_size = size;
+	}
+
+	memset(self->index, 0, self->index_size * sizeof(*self->index));
+	self->index_used = 0;
+
+	size_t links = self->count * sizeof(*self->child);
+
+	uint32_t *child = realloc(self->child, links * 3);
+	if (child == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	memset(child, 0, links * 3);
+	self->child = child;
+	self->sibling = child + self->count;
+	self->parent = child + self->count * 2;
+
+	ffs_hdr_t *hdr = self->hdr;
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++)
+		if (hdr->entries[i].type != 0)
+			__index_insert(self, i);
+
+	/* id -> entry map, to find the parent of each entry */
+	RAII(uint32_t *, ids, calloc(size, sizeof(*ids)), free);
+	if (ids == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	uint32_t mask = size - 1;
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++) {
+		if (hdr->entries[i].type == 0)
+			continue;
+
+		uint32_t slot = int64_hash1(hdr->entries[i].id) & mask;
+		while (ids[slot] != 0)
+			slot = (slot + 1) & mask;
+		ids[slot] = i + 1;
+	}
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++) {
+		ffs_entry_t *e = hdr->entries + i;
+
+		if (e->type == 0 || e->pid == FFS_PID_TOPLEVEL)
+			continue;
+
+		uint32_t slot = int64_hash1(e->pid) & mask;
+		while (ids[slot] != 0 &&
+		       hdr->entries[ids[slot] - 1].id != e->pid)
+			slot = (slot + 1) & mask;
+
+		if (ids[slot] != 0)
+			__tree_link(self, i, ids[slot] - 1);
+	}
+
+	/*
+	 * cached table state, kept up to date by add and delete.  Type 0
+	 * records read from the image count as tombstones.
+	 */
+	self->max_id = 0;
+	self->free_slot = hdr->entry_count;
+	self->tombstones = 0;
+	self->part = 0;
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++) {
+		ffs_entry_t *e = hdr->entries + i;
+
+		if (e->type == 0) {
+			self->free_slot = min(self->free_slot, i);
+			self->tombstones++;
+			continue;
+		}
+
+		self->max_id = max(self->max_id, e->id);
+
+		if (self->part == 0 && e->pid == FFS_PID_TOPLEVEL &&
+		    strncmp(e->name, FFS_PARTITION_NAME, sizeof(e->name)) == 0)
+			self->part = i + 1;
+	}
+
+	return 0;
+}
+
+static ffs_entry_t *__index_find(ffs_t * self, uint32_t pid, const char *name,
+				 size_t len)
+{
+	assert(self != NULL);
+	assert(self->index != NULL);
+
+	ffs_entry_t *e = NULL;
+
+	len = min(len, sizeof(e->name));
+	uint32_t mask = self->index_size - 1;
+	uint32_t slot = __index_hash(pid, name, len) & mask;
+
+	while (self->index[slot] != 0) {
+		e = self->hdr->entries + self->index[slot] - 1;
+
+		if (e->type != 0 && e->pid == pid &&
+		    memcmp(e->name, name, len) == 0 &&
+		    (len == sizeof(e->name) || e->name[len] == '\0'))
+			return e;
+
+		slot = (slot + 1) & mask;
+	}
+
+	return NULL;
+}
+
+static ffs_entry_t *__find_entry(ffs_t * self, const char *path)
+{
+	assert(self != NULL);
+
+	if (path == NULL || *path == '\0')
+		return NULL;
+
+	ffs_entry_t *parent = NULL;
+	uint32_t pid = FFS_PID_TOPLEVEL;
+
+	while (*path != '\0') {
+		const char *end = strchrnul(path, '/');
+
+		if (path < end) {
+			parent = __index_find(self, pid, path, end - path);
+			if (parent == NULL)
+				break;
+			pid = parent->id;
+		}
+
+		path = *end == '/' ? end + 1 : end;
+	}
+
+	if (parent != NULL && __entry_check(self, parent) < 0)
+		return NULL;
+
+	return parent;
+}
+
+/*
+ * Cached full path name of every entry, indexed like hdr->entries.  Built
+ * on first use and dropped whenever entries are added or removed.
+ */
+static void __names_free(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (self->names != NULL) {
+		for (uint32_t i = 0; i < self->names_count; i++)
+			if (self->names[i] != NULL)
+				free(self->names[i]);
+		free(self->names), self->names = NULL;
+	}
+
+	self->names_count = 0;
+}
+
+struct __id_map {
+	uint32_t id;
+	uint32_t i;
+};
+
+static int __id_compare(const void *a, const void *b)
+{
+	const struct __id_map *__a = a, *__b = b;
+	return (__a->id > __b->id) - (__a->id < __b->id);
+}
+
+static const char *__entry_name(ffs_t * self, const struct __id_map *map,
+				uint32_t i, uint32_t depth)
+{
+	assert(self != NULL);
+	assert(map != NULL);
+
+	if (self->names[i] != NULL)
+		return self->names[i];
+
+	ffs_hdr_t *hdr = self->hdr;
+	uint32_t count = hdr->entry_count;
+	ffs_entry_t *e = hdr->entries + i;
+	const char *prefix = "";
+
+	/* depth bounds the walk up a (corrupt) cyclic parent chain */
+	if (e->pid != FFS_PID_TOPLEVEL && depth < count) {
+		struct __id_map key = {.id = e->pid}, *p;
+
+		p = bsearch(&key, map, count, sizeof(*map), __id_compare);
+		if (p != NULL && p->i != i) {
+			prefix = __entry_name(self, map, p->i, depth + 1);
+			if (prefix == NULL)
+				return NULL;
+		}
+	}
+
+	size_t len = strnlen(e->name, sizeof(e->name));
+	size_t size = strlen(prefix) + len + 2;
+
+	self->names[i] = malloc(size);
+	if (self->names[i] == NULL) {
+		ERRNO(errno);
+		return NULL;
+	}
+
+	snprintf(self->names[i], size, "%s%s%.*s", prefix,
+		 *prefix ? "/" : "", (int)len, e->name);
+
+	return self->names[i];
+}
+
+static int __names_build(ffs_t * self)
+{
+	assert(self != NULL);
+
+	__names_free(self);
+
+	ffs_hdr_t *hdr = self->hdr;
+	uint32_t count = hdr->entry_count;
+
+	RAII(struct __id_map *, map, malloc((count + 1) * sizeof(*map)), free);
+	if (map == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	self->names = calloc(count + 1, sizeof(*self->names));
+	if (self->names == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+	self->names_count = count;
+
+	for (uint32_t i = 0; i < count; i++) {
+		map[i].id = hdr->entries[i].id;
+		map[i].i = i;
+	}
+
+	qsort(map, count, sizeof(*map), __id_compare);
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (__entry_name(self, map, i, 0) == NULL) {
+			__names_free(self);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Data extent index.  Every non-logical entry has a node in a splay tree
+ * ordered by (base, id).  As long as the extents are disjoint (which
+ * __ffs_entry_add() enforces) an overlap check or an address lookup only
+ * needs the neighbours of a block number.  Tables read from disk that
+ * already overlap, or hold zero sized entries, fall back to a linear scan.
+ */
+static int __extent_compare(const void *a, const void *b)
+{
+	const ffs_extent_t *__a = a, *__b = b;
+
+	if (__a->base != __b->base)
+		return __a->base < __b->base ? -1 : 1;
+	if (__a->id != __b->id)
+		return __a->id < __b->id ? -1 : 1;
+
+	return 0;
+}
+
+static ffs_extent_t *__extent_lookup(ffs_t * self, uint32_t base, bool next)
+{
+	assert(self != NULL);
+
+	if (self->extents.root == NULL)
+		return NULL;
+
+	ffs_extent_t key = {.base = base, .id = UINT32_MAX };
+	(void)splay_find(&self->extents, &key);
+
+	/* after the splay, the root is either the predecessor or the
+	 * successor of the key */
+	tree_node_t *node = self->extents.root;
+
+	if (__extent_compare(node->key, &key) <= 0) {
+		if (next == false)
+			return (ffs_extent_t *)node;
+		node = node->right;
+		while (node != NULL && node->left != NULL)
+			node = node->left;
+	} else {
+		if (next == true)
+			return (ffs_extent_t *)node;
+		node = node->left;
+		while (node != NULL && node->right != NULL)
+			node = node->right;
+	}
+
+	return (ffs_extent_t *)node;
+}
+
+static ffs_extent_t *__extent_overlap(ffs_t * self, uint32_t base,
+				      uint32_t size)
+{
+	assert(self != NULL);
+
+	ffs_extent_t *x = __extent_lookup(self, base, false);
+	if (x != NULL && base < (uint64_t)x->base + x->size)
+		return x;
+
+	x = __extent_lookup(self, base, true);
+	if (x != NULL && x->base < (uint64_t)base + size)
+		return x;
+
+	return NULL;
+}
+
+static void __extents_insert(ffs_t * self, uint32_t i)
+{
+	assert(self != NULL);
+	assert(self->extent_count < self->count);
+
+	ffs_entry_t *e = self->hdr->entries + i;
+
+	if (e->type == 0 || e->type == FFS_TYPE_LOGICAL)
+		return;
+
+	if (e->size == 0) {
+		self->overlap = true;
+		return;
+	}
+
+	if (self->overlap == false &&
+	    __extent_overlap(self, e->base, e->size) != NULL)
+		self->overlap = true;
+
+	ffs_extent_t *x = self->extent + self->extent_count;
+	x->base = e->base;
+	x->size = e->size;
+	x->id = e->id;
+	x->index = i;
+
+	if (splay_find(&self->extents, x) != NULL) {
+		/* duplicate id, the table is already inconsistent */
+		self->overlap = true;
+		return;
+	}
+
+	tree_node_init(&x->node, x);
+	if (splay_insert(&self->extents, &x->node) < 0)
+		return;
+
+	self->extent_count++;
+}
+
+static int __extents_build(ffs_t * self)
+{
+	assert(self != NULL);
+
+	ffs_extent_t *extent = realloc(self->extent,
+				       max(self->count, 1U) * sizeof(*extent));
+	if (extent == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	self->extent = extent;
+	self->extent_count = 0;
+	self->overlap = false;
+	self->extents_stale = false;
+
+	tree_init(&self->extents, __extent_compare);
+
+	for (uint32_t i = 0; i < self->hdr->entry_count; i++)
+		__extents_insert(self, i);
+
+	return 0;
+}
+
+/*
+ * Resizes the extent of entry i in place, the tree is keyed on base and id
+ * so only the successor needs to be checked for a new overlap.
+ */
+static void __extents_resize(ffs_t * self, uint32_t i)
+{
+	assert(self != NULL);
+
+	if (self->extents_stale == true)
+		return;
+
+	ffs_entry_t *e = self->hdr->entries + i;
+	ffs_extent_t key = {.base = e->base, .id = e->id };
+
+	ffs_extent_t *x = (ffs_extent_t *)splay_find(&self->extents, &key);
+	if (x == NULL) {
+		self->extents_stale = true;
+		return;
+	}
+
+	x->size = e->size;
+
+	ffs_extent_t *next = __extent_lookup(self, x->base, true);
+	if (next != NULL && next->base < (uint64_t)x->base + x->size)
+		self->overlap = true;
+}
+
+/*
+ * Deletes only mark the extent tree stale, it is rebuilt once on the next
+ * extent lookup.
+ */
+static int __extents_refresh(ffs_t * self)
+{
+	assert(self != NULL);
+
+	return self->extents_stale ? __extents_build(self) : 0;
+}
+
+static int __extents_walk(ffs_t * self, int (*func) (ffs_extent_t *, void *),
+			  void *ctx)
+{
+	assert(self != NULL);
+	assert(func != NULL);
+
+	RAII(tree_node_t **, stack,
+	     malloc((self->extent_count + 1) * sizeof(*stack)), free);
+	if (stack == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	/* in-order, lowest base first; splay trees can degenerate into
+	 * a list, so don't recurse */
+	tree_node_t *node = self->extents.root;
+	size_t top = 0;
+
+	while (node != NULL || 0 < top) {
+		while (node != NULL) {
+			stack[top++] = node;
+			node = node->left;
+		}
+
+		node = stack[--top];
+
+		int rc = func((ffs_extent_t *)node, ctx);
+		if (rc != 0)
+			return rc;
+
+		node = node->right;
+	}
+
+	return 0;
+}
+
+/*
+ * Deleted entries are left in place as zeroed tombstones (type 0), that are
+ * skipped by all lookups and may be reused by __ffs_entry_add().  The entry
+ * array is compacted once, when the table is flushed.
+ */
+static void __entry_tombstone(ffs_t * self, uint32_t i)
+{
+	assert(self != NULL);
+
+	memset(self->hdr->entries + i, 0, sizeof(*self->hdr->entries));
+
+	if (i < self->names_count && self->names[i] != NULL)
+		free(self->names[i]), self->names[i] = NULL;
+
+	self->child[i] = self->sibling[i] = self->parent[i] = 0;
+
+	self->tombstones++;
+	self->free_slot = min(self->free_slot, i);
+	self->extents_stale = true;
+	self->dirty = true;
+}
+
+static int __entries_compact(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (self->tombstones == 0)
+		return 0;
+
+	ffs_hdr_t *hdr = self->hdr;
+	uint32_t first = hdr->entry_count, j = 0;
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++) {
+		if (hdr->entries[i].type == 0) {
+			first = min(first, i);
+			continue;
+		}
+
+		if (i != j) {
+			hdr->entries[j] = hdr->entries[i];
+
+			uint32_t bit = 1U << (j % 32);
+			if (__bitmap_test(self->valid_map, self->valid_size, i))
+				self->valid_map[j / 32] |= bit;
+			else if (j < self->valid_size)
+				self->valid_map[j / 32] &= ~bit;
+		}
+		j++;
+	}
+
+	memset(hdr->entries + j, 0, (hdr->entry_count - j) * hdr->entry_size);
+
+	hdr->entry_count = j;
+	self->tombstones = 0;
+	__names_free(self);
+
+	if (__index_build(self) < 0)
+		return -1;
+	if (__extents_build(self) < 0)
+		return -1;
+
+	return __entries_dirty(self, first, hdr->entry_count);
+}
+
+/*
+ * Entry name patterns are POSIX basic regexes matched case insensitively
+ * against the full path name.  Each handle keeps the last few compiled
+ * patterns; a pattern that reduces to a literal, optionally anchored or
+ * wrapped in '.*' (i.e. 'bank0/.*'), is matched with plain string compares
+ * and never reaches regexec().
+ */
+static void __pattern_free(ffs_pattern_t * p)
+{
+	if (p->pattern == NULL)
+		return;
+
+	if (p->regex == true)
+		regfree(&p->rx);
+	free(p->pattern);
+
+	memset(p, 0, sizeof(*p));
+}
+
+static void __patterns_free(ffs_t * self)
+{
+	assert(self != NULL);
+
+	for (uint32_t i = 0; i < FFS_PATTERN_CACHE; i++)
+		__pattern_free(self->pattern + i);
+
+	self->pattern_next = 0;
+}
+
+static int __pattern_compile(ffs_pattern_t * p, const char *pattern)
+{
+	p->pattern = strdup(pattern);
+	if (p->pattern == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	char *lit = p->pattern;
+	size_t len = strlen(lit);
+
+	if (lit[0] == '^')
+		p->head = true, lit++, len--;
+	if (2 <= len && lit[0] == '.' && lit[1] == '*')
+		p->head = false, lit += 2, len -= 2;
+
+	if (1 <= len && lit[len - 1] == '$' &&
+	    (len < 2 || lit[len - 2] != '\\'))
+		p->tail = true, len--;
+	if (2 <= len && lit[len - 2] == '.' && lit[len - 1] == '*' &&
+	    (len < 3 || lit[len - 3] != '\\'))
+		p->tail = false, len -= 2;
+
+	p->literal = lit;
+	p->literal_len = len;
+
+	for (size_t i = 0; i < len && p->regex == false; i++)
+		p->regex = strchr(".[]*^$\\", lit[i]) != NULL;
+
+	if (p->regex == false)
+		return 0;
+
+	if (regcomp(&p->rx, pattern, REG_ICASE | REG_NOSUB) != 0) {
+		p->regex = false;
+		free(p->pattern), p->pattern = NULL;
+		UNEXPECTED("'%s' invalid entry name pattern", pattern);
+		return -1;
+	}
+
+	return 0;
+}
+
+static ffs_pattern_t *__pattern_get(ffs_t * self, const char *pattern)
+{
+	assert(self != NULL);
+	assert(pattern != NULL);
+
+	for (uint32_t i = 0; i < FFS_PATTERN_CACHE; i++)
+		if (self->pattern[i].pattern != NULL &&
+		    strcmp(self->pattern[i].pattern, pattern) == 0)
+			return self->pattern + i;
+
+	ffs_pattern_t *p = self->pattern + self->pattern_next;
+	self->pattern_next = (self->pattern_next + 1) % FFS_PATTERN_CACHE;
+
+	__pattern_free(p);
+	if (__pattern_compile(p, pattern) < 0)
+		return NULL;
+
+	return p;
+}
+
+static bool __pattern_match(ffs_pattern_t * p, const char *path)
+{
+	if (p->regex == true)
+		return regexec(&p->rx, path, 0, NULL, 0) != REG_NOMATCH;
+
+	size_t len = p->literal_len, n = strlen(path);
+
+	if (n < len)
+		return false;
+	if (p->head == true && p->tail == true)
+		return n == len && strncasecmp(path, p->literal, len) == 0;
+	if (p->head == true)
+		return strncasecmp(path, p->literal, len) == 0;
+	if (p->tail == true)
+		return strncasecmp(path + n - len, p->literal, len) == 0;
+
+	for (size_t i = 0; i + len <= n; i++)
+		if (strncasecmp(path + i, p->literal, len) == 0)
+			return true;
+
+	return false;
+}
+
+/* ============================================================ */
+
+int __ffs_fcheck(FILE *file, off_t offset)
+{
+	assert(file != NULL);
+
+	RAII(ffs_hdr_t*, hdr, malloc(sizeof(*hdr)), free);
+	if (hdr == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+	memset(hdr, 0, sizeof(*hdr));
+
+	if (fseeko(file, offset, SEEK_SET) != 0) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	if (fread(hdr, 1, sizeof(*hdr), file) <= 0 && ferror(file)) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	uint32_t ck = __hdr_decode(hdr, hdr);
+
+	if (hdr->magic != FFS_MAGIC) {
+		ERROR(ERR_UNEXPECTED, FFS_CHECK_HEADER_MAGIC,
+		      "header magic mismatch '%x' != '%x'",
+		      hdr->magic, FFS_MAGIC);
+		return FFS_CHECK_HEADER_MAGIC;
+	}
+	if (hdr->checksum != ck) {
+		ERROR(ERR_UNEXPECTED, FFS_CHECK_HEADER_CHECKSUM,
+		      "header checksum mismatch '%x' != '%x'",
+		      hdr->checksum, ck);
+	 	return FFS_CHECK_HEADER_CHECKSUM;
+	}
+
+	size_t size = hdr->entry_count * hdr->entry_size;
+
+	hdr = (ffs_hdr_t *)realloc(hdr, sizeof(*hdr) + size);
+	if (hdr == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+	memset(hdr->entries, 0, size);
+
+	if (0 < hdr->entry_count) {
+		if (fread(hdr->entries, 1, size, file) <= 0 && ferror(file)) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		for (size_t i = 0; i < hdr->entry_count; i++) {
+			ffs_entry_t *e = hdr->entries + i;
+
+			uint32_t ck = __entry_decode(e, e);
+
+			if (e->checksum != ck) {
+				ERROR(ERR_UNEXPECTED, FFS_CHECK_ENTRY_CHECKSUM,
+				      "'%s' entry checksum mismatch '%x' != "
+				      "'%x'", e->name, e->checksum, ck);
+				return FFS_CHECK_ENTRY_CHECKSUM;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int __ffs_check(const char *path, off_t offset)
+{
+	if (path == NULL || *path == '\0') {
+		UNEXPECTED("invalid path '%s'\n", path);
+		return -1;
+	}
+
+	RAII(FILE*, file, fopen(path, "r"), fclose);
+	if (file == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	return __ffs_fcheck(file, offset);
+}
+
+ffs_t *__ffs_fcreate(FILE *file, off_t offset, uint32_t block_size,
+		     uint32_t block_count)
+{
+	assert(file != NULL);
+
+	if (!is_pow2(block_size)) {
+		UNEXPECTED("'%d' invalid block size (must be non-0 and a "
+			   "power of 2)", block_size);
+		return NULL;
+	}
+	if (!is_pow2(block_count)) {
+		UNEXPECTED("'%d' invalid block count (must be non-0 and a "
+			   "power of 2)", block_count);
+		return NULL;
+	}
+	if (offset & (block_size - 1)) {
+		UNEXPECTED("'%lld' invalid offset (must be 'block size' "
+			   "aligned)", (long long)offset);
+		return NULL;
+	}
+
+	ffs_t *self = (ffs_t *) malloc(sizeof(*self));
+	if (self == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+
+	memset(self, 0, sizeof(*self));
+	self->file = file;
+	self->offset = offset;
+	self->count = FFS_ENTRY_EXTENT;
+	self->dirty = true;
+
+	self->hdr = (ffs_hdr_t *) malloc(sizeof(*self->hdr));
+	if (self->hdr == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+
+	self->hdr->magic = FFS_MAGIC;
+	self->hdr->version = FFS_VERSION_1;
+	self->hdr->size = 1;
+	self->hdr->entry_size = sizeof(*self->hdr->entries);
+	self->hdr->entry_count = 0;
+	self->hdr->block_size = block_size;
+	self->hdr->block_count = block_count;
+	self->hdr->checksum = 0;
+	self->hdr->resvd[0] = 0;
+	self->hdr->resvd[1] = 0;
+	self->hdr->resvd[2] = 0;
+	self->hdr->resvd[3] = 0;
+
+	size_t size = self->count * self->hdr->entry_size;
+
+	self->hdr = (ffs_hdr_t *) realloc(self->hdr, sizeof(*self->hdr) + size);
+	if (self->hdr == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+	memset(self->hdr->entries, 0, size);
+
+	if (__index_build(self) < 0)
+		goto error;
+	if (__extents_build(self) < 0)
+		goto error;
+
+	if (__ffs_entry_add(self, FFS_PARTITION_NAME, offset, block_size,
+			    FFS_TYPE_PARTITION, FFS_FLAGS_PROTECTED) < 0)
+		goto error;
+	if (__ffs_entry_truncate(self, FFS_PARTITION_NAME, block_size) < 0)
+		goto error;
+
+	if (false) {
+ error:
+		if (self != NULL) {
+			if (self->file != NULL)
+				fclose(self->file), self->file = NULL;
+			if (self->path != NULL)
+				free(self->path), self->path = NULL;
+			if (self->hdr != NULL)
+				free(self->hdr), self->hdr = NULL;
+			if (self->index != NULL)
+				free(self->index), self->index = NULL;
+			if (self->child != NULL)
+				free(self->child), self->child = NULL;
+			__names_free(self);
+			if (self->extent != NULL)
+				free(self->extent), self->extent = NULL;
+			if (self->dirty_map != NULL)
+				free(self->dirty_map), self->dirty_map = NULL;
+			if (self->wire != NULL)
+				free(self->wire), self->wire = NULL;
+			if (self->valid_map != NULL)
+				free(self->valid_map), self->valid_map = NULL;
+			free(self), self = NULL;
+		}
+	}
+
+	return self;
+}
+
+ffs_t *__ffs_create(const char *path, off_t offset, uint32_t block_size,
+		    uint32_t block_count)
+{
+	assert(path != NULL);
+
+	FILE * file = fopen(path, "r+");
+	if (file == NULL) {
+		ERRNO(errno);
+		return NULL;
+	}
+
+	ffs_t * self = __ffs_fcreate(file, offset, block_size, block_count);
+	if (self != NULL)
+		self->path = strdup(path);
+
+	return self;
+}
+
+ffs_t *__ffs_fopen(FILE * file, off_t offset)
+{
+	return __ffs_fopen_flags(file, offset, 0);
+}
+
+ffs_t *__ffs_fopen_flags(FILE * file, off_t offset, int flags)
 {
 	assert(file != NULL);
 
-	if (!is_pow2(block_size)) {
-		UNEXPECTED("'%d' invalid block size (must be non-0 and a "
-			   "power of 2)", block_size);
-		return NULL;
+	ffs_t *self = (ffs_t *) malloc(sizeof(*self));
+	if (self == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+
+	memset(self, 0, sizeof(*self));
+	self->file = file;
+	self->count = 0;
+	self->offset = offset;
+	self->dirty = false;
+	self->lazy = (flags & FFS_OPEN_LAZY) != 0;
+
+	__advise(self, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	self->hdr = (ffs_hdr_t *) malloc(sizeof(*self->hdr));
+	if (self->hdr == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+	memset(self->hdr, 0, sizeof(*self->hdr));
+
+	if (__hdr_read(self->hdr, self->file, self->offset) < 0)
+		goto error;
+
+	self->count = max(self->hdr->entry_count, FFS_ENTRY_EXTENT);
+	size_t size = self->count * self->hdr->entry_size;
+
+	self->hdr = (ffs_hdr_t *)realloc(self->hdr, sizeof(*self->hdr) + size);
+	if (self->hdr == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+	memset(self->hdr->entries, 0, size);
+
+	if (0 < self->hdr->entry_count) {
+		if (__entries_read(self->hdr, self->file,
+	 		           self->offset + sizeof(*self->hdr),
+				   self->lazy) < 0)
+			goto error;
+	}
+
+	if (__index_build(self) < 0)
+		goto error;
+	if (__extents_build(self) < 0)
+		goto error;
+
+	if (false) {
+ error:
+		if (self != NULL) {
+			if (self->hdr != NULL)
+				free(self->hdr), self->hdr = NULL;
+			if (self->index != NULL)
+				free(self->index), self->index = NULL;
+			if (self->child != NULL)
+				free(self->child), self->child = NULL;
+			__names_free(self);
+			if (self->extent != NULL)
+				free(self->extent), self->extent = NULL;
+			if (self->dirty_map != NULL)
+				free(self->dirty_map), self->dirty_map = NULL;
+			if (self->wire != NULL)
+				free(self->wire), self->wire = NULL;
+			if (self->valid_map != NULL)
+				free(self->valid_map), self->valid_map = NULL;
+
+			free(self), self = NULL;
+		}
+	}
+
+	return self;
+}
+
+ffs_t *__ffs_open(const char *path, off_t offset)
+{
+	return __ffs_open_flags(path, offset, 0);
+}
+
+ffs_t *__ffs_open_flags(const char *path, off_t offset, int flags)
+{
+	assert(path != NULL);
+
+	FILE *file = fopen(path, "r+");
+	if (file == NULL) {
+		ERRNO(errno);
+		return NULL;
+	}
+
+	ffs_t *self = __ffs_fopen_flags(file, offset, flags);
+	if (self != NULL)
+		self->path = strdup(path);
+
+	return self;
+}
+
+/*
+ * Read-only open through a shared mapping of the image.  The mapping is the
+ * table: the header and entry checksums are checked on the mapped (big
+ * endian) records in place and nothing is decoded or copied at open time.
+ * The records are read, unconverted, through __ffs_mentry() and the
+ * ffs_mentry_*() accessors; calls that need the host table (lookups,
+ * listing, data I/O) decode it on first use, see __table_load().
+ */
+ffs_t *__ffs_mopen(const char *path, off_t offset)
+{
+	assert(path != NULL);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ERRNO(errno);
+		return NULL;
+	}
+
+	ffs_t *self = (ffs_t *) malloc(sizeof(*self));
+	if (self == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+
+	memset(self, 0, sizeof(*self));
+	self->map = MAP_FAILED;
+	self->offset = offset;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		ERRNO(errno);
+		goto error;
+	}
+
+	uint64_t map_size = st.st_size;
+
+	if (S_ISBLK(st.st_mode)) {
+#ifdef BLKGETSIZE64
+		if (ioctl(fd, BLKGETSIZE64, &map_size) < 0) {
+			ERRNO(errno);
+			goto error;
+		}
+#else
+		UNEXPECTED("'%s' is a block device, mapping is not supported",
+			   path);
+		goto error;
+#endif
+	} else if (S_ISREG(st.st_mode) == false) {
+		UNEXPECTED("'%s' is not a regular file or block device",
+			   path);
+		goto error;
+	}
+
+	if (offset < 0 || map_size < offset + sizeof(ffs_hdr_t)) {
+		UNEXPECTED("'%lld' invalid offset, '%s' is '%llu' bytes",
+			   (long long)offset, path,
+			   (unsigned long long)map_size);
+		goto error;
+	}
+
+	self->map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (self->map == MAP_FAILED) {
+		ERRNO(errno);
+		goto error;
+	}
+	self->map_size = map_size;
+
+	const ffs_hdr_t *wire = self->map + offset;
+
+	self->hdr = (ffs_hdr_t *) malloc(sizeof(*self->hdr));
+	if (self->hdr == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+
+	uint32_t ck = __hdr_decode(self->hdr, wire);
+
+	if (self->hdr->magic != FFS_MAGIC) {
+		ERROR(ERR_UNEXPECTED, FFS_CHECK_HEADER_MAGIC,
+		      "magic number mismatch '%x' != '%x'",
+		      self->hdr->magic, FFS_MAGIC);
+		goto error;
+	}
+
+	if (self->hdr->checksum != ck) {
+		ERROR(ERR_UNEXPECTED, FFS_CHECK_HEADER_CHECKSUM,
+		      "header checksum mismatch '%x' != '%x'",
+		      self->hdr->checksum, ck);
+		goto error;
+	}
+
+	size_t size = self->hdr->entry_count * sizeof(ffs_entry_t);
+
+	if (self->hdr->entry_size != sizeof(ffs_entry_t) ||
+	    self->map_size - offset - sizeof(*wire) < size) {
+		UNEXPECTED("'%s' partition table at offset '%llx' is "
+			   "truncated", path, (long long)offset);
+		goto error;
+	}
+
+	for (uint32_t i = 0; i < self->hdr->entry_count; i++) {
+		const ffs_entry_t *e = wire->entries + i;
+
+		ck = memcpy_checksum(NULL, e, offsetof(ffs_entry_t, checksum));
+
+		if (be32toh(e->checksum) != ck) {
+			ERROR(ERR_UNEXPECTED, FFS_CHECK_ENTRY_CHECKSUM,
+			      "'%.*s' entry checksum mismatch '%x' != '%x'",
+			      (int)sizeof(e->name), e->name,
+			      be32toh(e->checksum), ck);
+			goto error;
+		}
+	}
+
+	self->file = fdopen(fd, "r");
+	if (self->file == NULL) {
+		ERRNO(errno);
+		goto error;
+	}
+	fd = -1;
+
+	self->path = strdup(path);
+
+	if (false) {
+ error:
+		if (self != NULL) {
+			if (self->map != MAP_FAILED)
+				munmap(self->map, self->map_size);
+			if (self->hdr != NULL)
+				free(self->hdr), self->hdr = NULL;
+
+			free(self), self = NULL;
+		}
+	}
+
+	if (0 <= fd)
+		close(fd);
+
+	return self;
+}
+
+/*
+ * Decode the host table of a mapped handle (and build its index and
+ * extents) the first time a call needs it.  'count' stays 0 until then.
+ */
+static int __table_load(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (self->map == NULL || 0 < self->count)
+		return 0;
+
+	ffs_hdr_t *hdr = self->hdr;
+	uint32_t count = max(hdr->entry_count, FFS_ENTRY_EXTENT);
+
+	hdr = (ffs_hdr_t *)realloc(hdr, sizeof(*hdr) +
+				   count * sizeof(ffs_entry_t));
+	if (hdr == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+	self->hdr = hdr;
+
+	memset(hdr->entries + hdr->entry_count, 0,
+	       (count - hdr->entry_count) * sizeof(ffs_entry_t));
+
+	const ffs_hdr_t *wire = self->map + self->offset;
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++)
+		(void)__entry_decode(hdr->entries + i, wire->entries + i);
+
+	self->count = count;
+
+	if (__index_build(self) < 0 || __extents_build(self) < 0) {
+		self->count = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+const ffs_entry_t *__ffs_mentry(ffs_t * self, uint32_t index)
+{
+	assert(self != NULL);
+
+	if (self->map == NULL) {
+		UNEXPECTED("partition table at offset '%llx' is not mapped",
+			   (long long)self->offset);
+		return NULL;
+	}
+
+	if (self->hdr->entry_count <= index) {
+		UNEXPECTED("entry '%d' outside range [0..%d]", index,
+			   self->hdr->entry_count);
+		return NULL;
+	}
+
+	const ffs_hdr_t *wire = self->map + self->offset;
+
+	return wire->entries + index;
+}
+
+static int __check_writable(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (self->map != NULL) {
+		UNEXPECTED("partition table at offset '%llx' is opened "
+			   "read-only", (long long)self->offset);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Durability.  Data and table writes go straight to the descriptor and are
+ * left to the kernel's write-back; a barrier (end of a partition, end of a
+ * table update, close) makes them durable according to the handle's sync
+ * policy:
+ *
+ *   FFS_SYNC_NONE	 flush stdio only (the default)
+ *   FFS_SYNC_BARRIER	 fdatasync() at each barrier
+ *   FFS_SYNC_WRITEBACK	 as above, and start write-back of every
+ *			 FFS_WRITEBACK_CHUNK of contiguous data as it is
+ *			 written, so the barrier has less left to wait for
+ */
+static void __writeback_start(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (self->wb_end <= self->wb_start)
+		return;
+
+#ifdef SYNC_FILE_RANGE_WRITE
+	int fd = fileno(self->file);
+	if (0 <= fd)
+		(void)sync_file_range(fd, self->wb_start,
+				      self->wb_end - self->wb_start,
+				      SYNC_FILE_RANGE_WRITE);
+#endif
+
+	self->wb_start = self->wb_end;
+}
+
+/*
+ * Data ranges written since the last barrier, the pages the barrier
+ * tells the kernel it can drop.  Sequential writes extend the last
+ * range; past FFS_RANGE_MAX ranges the last one is widened.
+ */
+static void __written_add(ffs_t * self, off_t offset, size_t size)
+{
+	assert(self != NULL);
+
+	if (self->sync == FFS_SYNC_NONE || self->io == FFS_IO_DIRECT ||
+	    size == 0)
+		return;
+
+	ffs_range_t *last = NULL;
+	if (0 < self->written_count)
+		last = self->written + self->written_count - 1;
+
+	if (last != NULL && last->end == offset) {
+		last->end = offset + size;
+		return;
+	}
+
+	if (self->written_count == self->written_size &&
+	    self->written_size < FFS_RANGE_MAX) {
+		uint32_t n = max(self->written_size * 2, 8U);
+		void *written = realloc(self->written,
+					n * sizeof(*self->written));
+		if (written != NULL) {
+			self->written = written;
+			self->written_size = n;
+		}
+	}
+
+	/* only a hint, a full table just widens the last range */
+	if (self->written_count == self->written_size) {
+		if (last != NULL) {
+			last->start = min(last->start, offset);
+			last->end = max(last->end, offset + (off_t)size);
+		}
+		return;
+	}
+
+	self->written[self->written_count++] = (ffs_range_t) {
+		.start = offset, .end = offset + size };
+}
+
+/* drop the cached pages of [start, end), never the table's */
+static void __drop_data(ffs_t * self, off_t start, off_t end)
+{
+	assert(self != NULL);
+
+	off_t table = self->offset;
+	off_t table_end = table;
+	if (self->hdr != NULL)
+		table_end += (off_t)self->hdr->size * self->hdr->block_size;
+
+	off_t head = min(end, table);
+	if (start < head)
+		__advise(self, start, head - start, POSIX_FADV_DONTNEED);
+
+	off_t tail = max(start, table_end);
+	if (tail < end)
+		__advise(self, tail, end - tail, POSIX_FADV_DONTNEED);
+}
+
+static void __written_drop(ffs_t * self)
+{
+	assert(self != NULL);
+
+	for (uint32_t i = 0; i < self->written_count; i++)
+		__drop_data(self, self->written[i].start,
+			    self->written[i].end);
+
+	self->written_count = 0;
+}
+
+static void __writeback(ffs_t * self, off_t offset, size_t size)
+{
+	assert(self != NULL);
+
+	self->unsynced = true;
+	__written_add(self, offset, size);
+
+	if (self->sync != FFS_SYNC_WRITEBACK)
+		return;
+
+	if (offset != self->wb_end) {
+		__writeback_start(self);
+		self->wb_start = offset;
+	}
+	self->wb_end = offset + size;
+
+	if (FFS_WRITEBACK_CHUNK <= self->wb_end - self->wb_start)
+		__writeback_start(self);
+}
+
+static int __barrier(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (fflush(self->file) != 0) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	self->wb_start = self->wb_end = 0;
+
+	if (self->sync != FFS_SYNC_NONE) {
+		int fd = fileno(self->file);
+
+		/* pipes and character devices can't be synced */
+		if (0 <= fd && fdatasync(fd) < 0 &&
+		    errno != EINVAL && errno != EROFS) {
+			ERRNO(errno);
+			return -1;
+		}
+
+		/* durable now, so the cached data pages are clean */
+		__written_drop(self);
+	}
+
+	self->written_count = 0;
+	self->unsynced = false;
+
+	return 0;
+}
+
+static int ffs_flush(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (__entries_compact(self) < 0)
+		return -1;
+
+	if (__hdr_write(self) < 0)
+		return -1;
+
+	if (__barrier(self) < 0)
+		return -1;
+
+	self->dirty = false;
+
+	return 0;
+}
+
+int __ffs_info(ffs_t * self, int name, uint32_t *value)
+{
+	assert(self != NULL);
+	assert(value != NULL);
+
+	switch (name) {
+	case FFS_INFO_MAGIC:
+		*value = self->hdr->magic;
+		break;
+	case FFS_INFO_VERSION:
+		*value = self->hdr->version;
+		break;
+	case FFS_INFO_ENTRY_SIZE:
+		*value = self->hdr->entry_size;
+		break;
+	case FFS_INFO_ENTRY_COUNT:
+		*value = self->hdr->entry_count - self->tombstones;
+		break;
+	case FFS_INFO_BLOCK_SIZE:
+		*value = self->hdr->block_size;
+		break;
+	case FFS_INFO_BLOCK_COUNT:
+		*value = self->hdr->block_count;
+		break;
+	case FFS_INFO_OFFSET:
+		*value = self->offset;
+		break;
+	case FFS_INFO_BLOCKS_WRITTEN:
+		*value = self->blocks_written;
+		break;
+	case FFS_INFO_BLOCKS_SKIPPED:
+		*value = self->blocks_skipped;
+		break;
+	default:
+		UNEXPECTED("'%d' invalid info field", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int __ffs_fclose(ffs_t * self)
+{
+	if (self == NULL)
+		return 0;
+
+	if (self->txn != NULL)
+		if (__ffs_txn_abort(self) < 0)
+			return -1;
+
+	if (self->dirty == true) {
+		if (ffs_flush(self) < 0)
+			return -1;
+	} else if (self->unsynced == true) {
+		if (__barrier(self) < 0)
+			return -1;
+	}
+
+	if (self->hdr != NULL)
+		free(self->hdr), self->hdr = NULL;
+	if (self->index != NULL)
+		free(self->index), self->index = NULL;
+	if (self->child != NULL)
+		free(self->child), self->child = NULL;
+	__names_free(self);
+	__patterns_free(self);
+	__ring_free(self);
+	__direct_close(self);
+	if (self->extent != NULL)
+		free(self->extent), self->extent = NULL;
+	if (self->dirty_map != NULL)
+		free(self->dirty_map), self->dirty_map = NULL;
+	if (self->wire != NULL)
+		free(self->wire), self->wire = NULL;
+	if (self->written != NULL)
+		free(self->written), self->written = NULL;
+	if (self->valid_map != NULL)
+		free(self->valid_map), self->valid_map = NULL;
+	if (self->txn_valid != NULL)
+		free(self->txn_valid), self->txn_valid = NULL;
+	if (self->txn_dirty_map != NULL)
+		free(self->txn_dirty_map), self->txn_dirty_map = NULL;
+	if (self->txn != NULL)
+		free(self->txn), self->txn = NULL;
+	if (self->map != NULL)
+		munmap(self->map, self->map_size), self->map = NULL;
+
+	memset(self, 0, sizeof(*self));
+	free(self);
+
+	return 0;
+}
+
+int __ffs_close(ffs_t * self)
+{
+	if (self == NULL)
+		return 0;
+
+	if (self->txn != NULL)
+		if (__ffs_txn_abort(self) < 0)
+			return -1;
+
+	if (self->dirty == true) {
+		if (ffs_flush(self) < 0)
+			return -1;
+	} else if (self->unsynced == true) {
+		if (__barrier(self) < 0)
+			return -1;
+	}
+
+	if (self->path != NULL)
+		free(self->path), self->path = NULL;
+	if (self->file != NULL)
+		fclose(self->file), self->file = NULL;
+
+	return __ffs_fclose(self);
+}
+
+int __ffs_fsync(ffs_t * self)
+{
+	assert(self != NULL);
+
+	return __barrier(self);
+}
+
+int __ffs_sync_policy(ffs_t * self, int sync)
+{
+	assert(self != NULL);
+
+	if (sync != FFS_SYNC_NONE && sync != FFS_SYNC_BARRIER &&
+	    sync != FFS_SYNC_WRITEBACK) {
+		UNEXPECTED("'%d' invalid sync policy", sync);
+		return -1;
+	}
+
+	self->sync = sync;
+
+	return 0;
+}
+
+/*
+ * Table edits made between __ffs_txn_begin() and __ffs_txn_commit() stay
+ * in memory, the whole table is checked and then written once.  Only the
+ * table metadata is transactional, data written to the partitions isn't.
+ */
+int __ffs_txn_begin(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (__check_writable(self) < 0)
+		return -1;
+
+	if (self->txn != NULL) {
+		UNEXPECTED("transaction already in progress for table at "
+			   "offset '%llx'", (long long)self->offset);
+		return -1;
+	}
+
+	size_t size = sizeof(*self->hdr) + self->count * self->hdr->entry_size;
+
+	self->txn = (ffs_hdr_t *) malloc(size);
+	if (self->txn == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	memcpy(self->txn, self->hdr, size);
+
+	if (self->valid_map != NULL) {
+		self->txn_valid = (uint32_t *) malloc(self->valid_size / 8);
+		if (self->txn_valid == NULL) {
+			ERRNO(errno);
+			free(self->txn), self->txn = NULL;
+			return -1;
+		}
+		memcpy(self->txn_valid, self->valid_map, self->valid_size / 8);
+	}
+
+	if (self->dirty_map != NULL) {
+		self->txn_dirty_map = (uint32_t *) malloc(self->dirty_size / 8);
+		if (self->txn_dirty_map == NULL) {
+			ERRNO(errno);
+			if (self->txn_valid != NULL)
+				free(self->txn_valid), self->txn_valid = NULL;
+			free(self->txn), self->txn = NULL;
+			return -1;
+		}
+		memcpy(self->txn_dirty_map, self->dirty_map,
+		       self->dirty_size / 8);
+	}
+
+	self->txn_count = self->count;
+	self->txn_tombstones = self->tombstones;
+	self->txn_valid_size = self->valid_size;
+	self->txn_dirty_size = self->dirty_size;
+	self->txn_dirty = self->dirty;
+	self->txn_overlap = self->overlap;
+
+	return 0;
+}
+
+static int __txn_check(ffs_t * self)
+{
+	assert(self != NULL);
+
+	ffs_hdr_t *hdr = self->hdr;
+
+	if (self->overlap == true && self->txn_overlap == false) {
+		UNEXPECTED("transaction for table at offset '%llx' creates "
+			   "overlapping partition entries",
+			   (long long)self->offset);
+		return -1;
+	}
+
+	RAII(struct __id_map *, map,
+	     malloc((hdr->entry_count + 1) * sizeof(*map)), free);
+	if (map == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++) {
+		map[i].id = hdr->entries[i].id;
+		map[i].i = i;
+	}
+
+	qsort(map, hdr->entry_count, sizeof(*map), __id_compare);
+
+	for (uint32_t i = 0; i < hdr->entry_count; i++) {
+		ffs_entry_t *e = hdr->entries + i;
+		struct __id_map key = {.id = e->pid};
+
+		if (e->type == 0 || e->pid == FFS_PID_TOPLEVEL)
+			continue;
+
+		if (bsearch(&key, map, hdr->entry_count, sizeof(*map),
+			    __id_compare) == NULL) {
+			UNEXPECTED("'%.*s' parent id '%d' not found in table "
+				   "at offset '%llx'", (int)sizeof(e->name),
+				   e->name, e->pid, (long long)self->offset);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int __ffs_txn_commit(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (self->txn == NULL) {
+		UNEXPECTED("no transaction in progress for table at offset "
+			   "'%llx'", (long long)self->offset);
+		return -1;
+	}
+
+	if (__txn_check(self) < 0)
+		return -1;
+
+	if (self->dirty == true)
+		if (ffs_flush(self) < 0)
+			return -1;
+
+	free(self->txn), self->txn = NULL;
+	if (self->txn_valid != NULL)
+		free(self->txn_valid), self->txn_valid = NULL;
+	if (self->txn_dirty_map != NULL)
+		free(self->txn_dirty_map), self->txn_dirty_map = NULL;
+
+	return 0;
+}
+
+int __ffs_txn_abort(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (self->txn == NULL)
+		return 0;
+
+	free(self->hdr);
+	self->hdr = self->txn, self->txn = NULL;
+	self->count = self->txn_count;
+	self->tombstones = self->txn_tombstones;
+	self->dirty = self->txn_dirty;
+	self->overlap = self->txn_overlap;
+
+	if (self->valid_map != NULL)
+		free(self->valid_map);
+	self->valid_map = self->txn_valid, self->txn_valid = NULL;
+	self->valid_size = self->txn_valid_size;
+
+	if (self->dirty_map != NULL)
+		free(self->dirty_map);
+	self->dirty_map = self->txn_dirty_map, self->txn_dirty_map = NULL;
+	self->dirty_size = self->txn_dirty_size;
+
+	__names_free(self);
+
+	if (__index_build(self) < 0)
+		return -1;
+	if (__extents_build(self) < 0)
+		return -1;
+
+	return 0;
+}
+
+struct __span {
+	off_t start;
+	off_t end;
+};
+
+static int __find_overlap(ffs_entry_t * entry, void *ctx)
+{
+	struct __span *new = ctx;
+
+	if (entry->type == FFS_TYPE_LOGICAL)
+		return 0;
+
+	off_t entry_start = entry->base;
+	off_t entry_end = entry_start + entry->size - 1;
+
+	return !(new->start < entry_start && new->end < entry_start) &&
+	       !(entry_end < new->start && entry_end < new->end);
+}
+
+static ffs_entry_t *__add_entry_check(ffs_t * self, off_t offset,
+				      size_t size)
+{
+	assert(self != NULL);
+
+	ffs_hdr_t *hdr = self->hdr;
+
+	off_t new_start = offset / hdr->block_size;
+	off_t new_end = new_start + (size / hdr->block_size) - 1;
+
+	if (self->overlap == false && new_start <= new_end) {
+		ffs_extent_t *x = __extent_overlap(self, new_start,
+						   new_end - new_start + 1);
+		return x == NULL ? NULL : hdr->entries + x->index;
+	}
+
+	struct __span new = {.start = new_start, .end = new_end };
+
+	return __iterate_entries(hdr, NULL, __find_overlap, &new);
+}
+
+struct __check {
+	ffs_t *self;
+	ffs_iterate_fn func;
+	void *ctx;
+	int rc;
+};
+
+static int __check_entry(ffs_entry_t * entry, void *ctx)
+{
+	struct __check *check = ctx;
+
+	check->rc = __entry_check(check->self, entry);
+	if (check->rc == 0)
+		check->rc = check->func(entry, check->ctx);
+
+	return check->rc;
+}
+
+int __ffs_iterate_entries_ctx(ffs_t * self, const ffs_filter_t * filter,
+			      ffs_iterate_fn func, void *ctx)
+{
+	assert(self != NULL);
+	assert(func != NULL);
+
+	if (__table_load(self) < 0)
+		return -1;
+
+	struct __check check = {.self = self, .func = func, .ctx = ctx };
+
+	(void)__iterate_entries(self->hdr, filter, __check_entry, &check);
+
+	return check.rc;
+}
+
+static int __call_entry(ffs_entry_t * entry, void *ctx)
+{
+	return (*(int (**)(ffs_entry_t *))ctx)(entry);
+}
+
+int __ffs_iterate_entries(ffs_t * self, int (*func) (ffs_entry_t *))
+{
+	return __ffs_iterate_entries_ctx(self, NULL, __call_entry, &func) != 0;
+}
+
+int __ffs_verify_all(ffs_t * self)
+{
+	assert(self != NULL);
+
+	if (__table_load(self) < 0)
+		return -1;
+
+	for (uint32_t i = 0; i < self->hdr->entry_count; i++)
+		if (self->hdr->entries[i].type != 0 &&
+		    __entry_check(self, self->hdr->entries + i) < 0)
+			return -1;
+
+	return 0;
+}
+
+struct __print {
+	ffs_t *self;
+	const char *name;
+	bool user;
+	char full_name[4096];
+};
+
+static int __print_entry(ffs_entry_t * entry, void *ctx)
+{
+	struct __print *print = ctx;
+	ffs_t *self = print->self;
+
+	uint32_t offset = entry->base * self->hdr->block_size;
+	uint32_t size = entry->size * self->hdr->block_size;
+
+	if (__entry_check(self, entry) < 0)
+		return -1;
+
+	int rc = __ffs_entry_match(self, print->name, entry);
+	if (rc <= 0)
+		return rc;
+
+	if (__ffs_entry_name(self, entry, print->full_name,
+			     sizeof print->full_name) < 0)
+		return -1;
+
+	fprintf(stdout, "%3d [%08x-%08x:%8x] "
+		"[%c%c%c%c%c%c%c%c%c%c] %s\n",
+		entry->id, offset, offset+size-1, entry->actual,
+		entry->type == FFS_TYPE_LOGICAL ? 'l' : 'd',
+/* reserved */	'-', '-', '-', '-', '-', '-', '-',
+		entry->flags & FFS_FLAGS_U_BOOT_ENV ? 'b' : '-',
+		entry->flags & FFS_FLAGS_PROTECTED ? 'p' : '-',
+		print->full_name);
+
+	if (print->user == true) {
+		for (int i=0; i<FFS_USER_WORDS; i++) {
+			fprintf(stdout, "[%2d] %8x ", i,
+				entry->user.data[i]);
+			if ((i+1) % 4 == 0)
+				fprintf(stdout, "\n");
+		}
+	}
+
+	return 0;
+}
+
+int __ffs_list_entries(ffs_t * self, const char * name, bool user, FILE * out)
+{
+	assert(self != NULL);
+
+	if (out == NULL)
+		out = stdout;
+
+	if (__table_load(self) < 0)
+		return -1;
+
+	struct __print print = {.self = self, .name = name, .user = user };
+
+	if (0 < self->count) {
+		if (__pattern_get(self, name) == NULL)
+			return -1;
+
+		fprintf(out, "========================[ PARTITION TABLE 0x%llx "
+			"]=======================\n", (long long)self->offset);
+		fprintf(out, "vers:%04x size:%04x * blk:%06x blk(s):%06x * "
+			"entsz:%06x ent(s):%06x\n",
+			self->hdr->version, self->hdr->size,
+			self->hdr->block_size, self->hdr->block_count,
+			self->hdr->entry_size,
+			self->hdr->entry_count - self->tombstones);
+		fprintf(out, "------------------------------------------------"
+			"---------------------------\n");
+
+		(void)__iterate_entries(self->hdr, NULL, __print_entry, &print);
+
+		fprintf(stdout, "\n");
+	}
+
+	return 0;
+}
+
+int __ffs_entry_find(ffs_t *self, const char *path, ffs_entry_t *entry)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+
+	if (__table_load(self) < 0)
+		return false;
+
+	ffs_entry_t *__entry = __find_entry(self, path);
+	if (__entry != NULL && entry != NULL)
+		*entry = *__entry;
+
+	return __entry != NULL;
+}
+
+int __ffs_entry_find_parent(ffs_t *self, const char *path, ffs_entry_t *entry)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+
+	if (*path == '/')
+		path++;
+
+	char __path[strlen(path) + 1];
+	strcpy(__path, path);
+	char *parent_path = dirname(__path);
+
+	int found = 0;
+
+	if (strcmp(parent_path, ".") != 0) {
+		ffs_entry_t parent;
+
+		found = __ffs_entry_find(self, parent_path, &parent);
+
+		if (found && entry != NULL)
+			*entry = parent;
+	}
+
+	return found;
+}
+
+static int __find_offset(ffs_entry_t * e, void *ctx)
+{
+	off_t block = *(off_t *)ctx;
+
+	if (e->type == FFS_TYPE_LOGICAL)
+		return 0;
+
+	return e->base <= block && block < (off_t)e->base + e->size;
+}
+
+int __ffs_entry_find_by_offset(ffs_t *self, off_t offset, ffs_entry_t *entry)
+{
+	assert(self != NULL);
+
+	if (offset < 0)
+		return 0;
+
+	if (__table_load(self) < 0 || __extents_refresh(self) < 0)
+		return -1;
+
+	ffs_hdr_t *hdr = self->hdr;
+	off_t block = offset / hdr->block_size;
+	ffs_entry_t *__entry = NULL;
+
+	if (self->overlap == false) {
+		ffs_extent_t *x = NULL;
+
+		if (block <= UINT32_MAX)
+			x = __extent_lookup(self, block, false);
+		if (x != NULL && block < (off_t)x->base + x->size)
+			__entry = hdr->entries + x->index;
+	} else {
+		__entry = __iterate_entries(hdr, NULL, __find_offset, &block);
+	}
+
+	if (__entry != NULL && __entry_check(self, __entry) < 0)
+		return -1;
+
+	if (__entry != NULL && entry != NULL)
+		*entry = *__entry;
+
+	return __entry != NULL;
+}
+
+int __ffs_entry_name(ffs_t *self, ffs_entry_t *entry, char *name, size_t size)
+{
+	assert(self != NULL);
+	assert(entry != NULL);
+
+	if (size == 0)
+		return 0;
+
+	if (__table_load(self) < 0)
+		return -1;
+	if (self->names == NULL)
+		if (__names_build(self) < 0)
+			return -1;
+
+	ffs_hdr_t *hdr = self->hdr;
+	ffs_entry_t *e = entry;
+
+	if (e < hdr->entries || hdr->entries + hdr->entry_count <= e)
+		e = __index_find(self, entry->pid, entry->name,
+				 strnlen(entry->name, sizeof(entry->name)));
+
+	if (e != NULL) {
+		snprintf(name, size, "%s", self->names[e - hdr->entries]);
+		return 0;
+	}
+
+	/* entry is not part of this table, name it after its parent */
+	const char *prefix = "";
+	if (entry->pid != FFS_PID_TOPLEVEL) {
+		for (uint32_t i = 0; i < hdr->entry_count; i++) {
+			if (hdr->entries[i].id == entry->pid) {
+				prefix = self->names[i];
+				break;
+			}
+		}
+	}
+
+	snprintf(name, size, "%s%s%.*s", prefix, *prefix ? "/" : "",
+		 (int)sizeof(entry->name), entry->name);
+
+	return 0;
+}
+
+int __ffs_entry_match(ffs_t * self, const char *pattern, ffs_entry_t * entry)
+{
+	assert(self != NULL);
+	assert(pattern != NULL);
+	assert(entry != NULL);
+
+	ffs_pattern_t *p = __pattern_get(self, pattern);
+	if (p == NULL)
+		return -1;
+
+	if (__table_load(self) < 0)
+		return -1;
+	if (self->names == NULL)
+		if (__names_build(self) < 0)
+			return -1;
+
+	ffs_hdr_t *hdr = self->hdr;
+
+	if (hdr->entries <= entry && entry < hdr->entries + hdr->entry_count &&
+	    self->names[entry - hdr->entries] != NULL)
+		return __pattern_match(p, self->names[entry - hdr->entries]);
+
+	char name[4096];
+	if (__ffs_entry_name(self, entry, name, sizeof name) < 0)
+		return -1;
+
+	return __pattern_match(p, name);
+}
+
+/*
+ * Grow the entry array to hold at least 'count' entries.  The array grows
+ * geometrically on add, layout builders can size it once up front.
+ */
+int __ffs_reserve(ffs_t * self, uint32_t count)
+{
+	assert(self != NULL);
+
+	if (__check_writable(self) < 0)
+		return -1;
+
+	if (count <= self->count)
+		return 0;
+
+	size_t size = count * self->hdr->entry_size;
+
+	ffs_hdr_t *hdr = (ffs_hdr_t *) realloc(self->hdr,
+					       sizeof(*self->hdr) + size);
+	if (hdr == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	memset(hdr->entries + self->count, 0,
+	       (count - self->count) * hdr->entry_size);
+
+	self->hdr = hdr;
+	self->count = count;
+
+	if (__index_build(self) < 0)
+		return -1;
+	if (__extents_build(self) < 0)
+		return -1;
+
+	return 0;
+}
+
+int __ffs_entry_add(ffs_t * self, const char *path, off_t offset, uint32_t size,
+		    ffs_type_t type, uint32_t flags)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+
+	if (__check_writable(self) < 0)
+		return -1;
+
+	if (__ffs_entry_find(self, path, NULL) == true) {
+		UNEXPECTED("'%s' entry already exists", path);
+		return -1;
+	}
+
+	ffs_entry_t parent = {.id = FFS_PID_TOPLEVEL };
+	(void)__ffs_entry_find_parent(self, path, &parent);
+
+	ffs_hdr_t *hdr = self->hdr;
+
+	if (__extents_refresh(self) < 0)
+		return -1;
+
+	if (type != FFS_TYPE_LOGICAL) {
+		ffs_entry_t *overlap = __add_entry_check(self, offset, size);
+		if (overlap != NULL) {
+			UNEXPECTED("'%s' at offset %lld and size %d overlaps "
+				   "'%s' at offset %d and size %d",
+				   path, (long long)offset, size, overlap->name,
+				   overlap->base * hdr->block_size,
+				   overlap->size * hdr->block_size);
+			return -1;
+		}
+	}
+
+	if (self->tombstones == 0 && self->count <= hdr->entry_count) {
+		if (__ffs_reserve(self, max(self->count * 2,
+				  self->count + FFS_ENTRY_EXTENT)) < 0)
+			return -1;
+		hdr = self->hdr;
 	}
-	if (!is_pow2(block_count)) {
-		UNEXPECTED("'%d' invalid block count (must be non-0 and a "
-			   "power of 2)", block_count);
-		return NULL;
+
+	uint32_t i = self->free_slot;
+	ffs_entry_t *entry = hdr->entries + i;
+
+	char name[strlen(path) + 1];
+	strcpy(name, path);
+	strncpy(entry->name, basename(name), sizeof(entry->name));
+	entry->id = ++self->max_id;
+	entry->pid = parent.id;
+	entry->base = offset / hdr->block_size;
+	entry->size = size / hdr->block_size;
+	entry->type = type;
+	entry->flags = flags;
+	entry->checksum = 0;
+
+	if (i < hdr->entry_count)
+		self->tombstones--;
+	else
+		hdr->entry_count++;
+	__names_free(self);
+
+	if (self->tombstones == 0)
+		self->free_slot = hdr->entry_count;
+	else
+		do
+			self->free_slot++;
+		while (hdr->entries[self->free_slot].type != 0);
+
+	if (self->part == 0 && parent.id == FFS_PID_TOPLEVEL &&
+	    strncmp(entry->name, FFS_PARTITION_NAME, sizeof(entry->name)) == 0)
+		self->part = i + 1;
+
+	if (self->lazy == true)
+		if (__bitmap_set(&self->valid_map, &self->valid_size,
+				 i, i + 1) < 0)
+			return -1;
+
+	if (self->index_size < (self->index_used + 1) * 2) {
+		if (__index_build(self) < 0)
+			return -1;
+	} else {
+		__index_insert(self, i);
+
+		if (parent.id != FFS_PID_TOPLEVEL) {
+			ffs_entry_t *p = __index_find(self, parent.pid,
+					parent.name, strnlen(parent.name,
+						sizeof(parent.name)));
+			if (p != NULL)
+				__tree_link(self, i, p - hdr->entries);
+		}
 	}
-	if (offset & (block_size - 1)) {
-		UNEXPECTED("'%lld' invalid offset (must be 'block size' "
-			   "aligned)", (long long)offset);
-		return NULL;
+	__extents_insert(self, i);
+
+    // Need to update 'part' entry as well as ffs hdr
+    // if the required number of blocks changes
+    uint32_t blocksNeeded = (hdr->entry_count * hdr->entry_size + FFS_HDR_SIZE_NO_ENTRY) / hdr->block_size;
+    if(hdr->entry_count * hdr->entry_size + FFS_HDR_SIZE_NO_ENTRY % hdr->block_size)
+    {
+        blocksNeeded++;
+    }
+
+    if(hdr->size != blocksNeeded)
+    {
+        if (self->part == 0) {
+            UNEXPECTED("entry '%s' not found in table at offset '%llx'",
+                       FFS_PARTITION_NAME, (long long)self->offset);
+                       return -1;
+        }
+
+        ffs_entry_t *entry_p = hdr->entries + self->part - 1;
+
+        hdr->size = blocksNeeded;
+        entry_p->size = blocksNeeded;
+        entry_p->actual = blocksNeeded * hdr->block_size;
+
+        __extents_resize(self, self->part - 1);
+        if (__entry_dirty(self, entry_p) < 0)
+            return -1;
+    }
+
+	if (__entry_dirty(self, entry) < 0)
+		return -1;
+
+	return 0;
+}
+
+struct __gap {
+	uint64_t blocks;
+	uint64_t count;
+	int fit;
+	uint64_t next;
+	uint64_t best_gap;
+	int64_t best;
+};
+
+static int __gap(struct __gap *g, uint64_t start, uint64_t end)
+{
+	uint64_t base = __align(start, g->blocks);
+
+	if (end < base + g->count)
+		return 0;
+
+	if (g->fit == FFS_FIT_FIRST) {
+		g->best = base;
+		return 1;
 	}
 
-	ffs_t *self = (ffs_t *) malloc(sizeof(*self));
-	if (self == NULL) {
-		ERRNO(errno);
-		goto error;
+	if (end - start < g->best_gap)
+		g->best_gap = end - start, g->best = base;
+
+	return 0;
+}
+
+static int __find_gap(ffs_extent_t * x, void *ctx)
+{
+	struct __gap *g = ctx;
+
+	if (g->next < x->base && __gap(g, g->next, x->base))
+		return 1;
+	g->next = max(g->next, (uint64_t)x->base + x->size);
+
+	return 0;
+}
+
+int __ffs_extent_alloc(ffs_t * self, size_t size, uint32_t align, int fit,
+		       off_t * offset)
+{
+	assert(self != NULL);
+	assert(offset != NULL);
+
+	if (__table_load(self) < 0)
+		return -1;
+
+	ffs_hdr_t *hdr = self->hdr;
+
+	if (align < hdr->block_size)
+		align = hdr->block_size;
+	if (!is_pow2(align)) {
+		UNEXPECTED("'%x' invalid alignment (must be a power of 2)",
+			   align);
+		return -1;
+	}
+	if (fit != FFS_FIT_FIRST && fit != FFS_FIT_BEST) {
+		UNEXPECTED("'%d' invalid fit", fit);
+		return -1;
 	}
 
-	memset(self, 0, sizeof(*self));
-	self->file = file;
-	self->offset = offset;
-	self->count = FFS_ENTRY_EXTENT;
-	self->dirty = true;
+	if (__extents_refresh(self) < 0)
+		return -1;
 
-	self->hdr = (ffs_hdr_t *) malloc(sizeof(*self->hdr));
-	if (self->hdr == NULL) {
+	uint64_t count = size / hdr->block_size;
+	if (count == 0) {
+		UNEXPECTED("'%zx' invalid size (must be at least one block)",
+			   size);
+		return -1;
+	}
+
+	struct __gap g = {
+		.blocks = align / hdr->block_size,
+		.count = count,
+		.fit = fit,
+		.best_gap = UINT64_MAX,
+		.best = -1,
+	};
+
+	int rc = __extents_walk(self, __find_gap, &g);
+	if (rc < 0)
+		return -1;
+	if (rc == 0 && g.next < hdr->block_count)
+		(void)__gap(&g, g.next, hdr->block_count);
+
+	int64_t best = g.best;
+
+	if (best < 0) {
+		UNEXPECTED("no free extent of size '%zx' and alignment '%x' in "
+			   "table at offset '%llx'", size, align,
+			   (long long)self->offset);
+		return -1;
+	}
+
+	*offset = best * hdr->block_size;
+
+	return 0;
+}
+
+off_t __ffs_entry_add_auto(ffs_t * self, const char *path, uint32_t size,
+			   uint32_t align, int fit, ffs_type_t type,
+			   uint32_t flags)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+
+	off_t offset = 0;
+
+	if (type != FFS_TYPE_LOGICAL)
+		if (__ffs_extent_alloc(self, size, align, fit, &offset) < 0)
+			return -1;
+
+	if (__ffs_entry_add(self, path, offset, size, type, flags) < 0)
+		return -1;
+
+	return offset;
+}
+
+int __ffs_entry_delete(ffs_t * self, const char *path)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+
+	if (__check_writable(self) < 0)
+		return -1;
+
+	ffs_entry_t *entry = __find_entry(self, path);
+	if (entry == NULL) {
+		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
+			  path, (long long)self->offset);
+		return -1;
+	}
+
+	if (entry->type == FFS_TYPE_PARTITION) {
+		UNEXPECTED("'%s' cannot --delete partition type entries", path);
+		return -1;
+	}
+
+	uint32_t i = entry - self->hdr->entries, children = 0;
+
+	for (uint32_t c = self->child[i]; c != 0; c = self->sibling[c - 1])
+		children++;
+
+	if (0 < children) {
+		UNEXPECTED("'%s' has '%d' children, --delete those first",
+			   path, children);
+		return -1;
+	}
+
+	__tree_unlink(self, i);
+	__entry_tombstone(self, i);
+
+	return 0;
+}
+
+int __ffs_entry_delete_tree(ffs_t * self, const char *path)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+
+	if (__check_writable(self) < 0)
+		return -1;
+
+	ffs_entry_t *entry = __find_entry(self, path);
+	if (entry == NULL) {
+		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
+			  path, (long long)self->offset);
+		return -1;
+	}
+
+	ffs_hdr_t *hdr = self->hdr;
+
+	RAII(uint32_t *, stack, malloc(hdr->entry_count * sizeof(*stack)),
+	     free);
+	if (stack == NULL) {
 		ERRNO(errno);
-		goto error;
+		return -1;
 	}
 
-	self->hdr->magic = FFS_MAGIC;
-	self->hdr->version = FFS_VERSION_1;
-	self->hdr->size = 1;
-	self->hdr->entry_size = sizeof(*self->hdr->entries);
-	self->hdr->entry_count = 0;
-	self->hdr->block_size = block_size;
-	self->hdr->block_count = block_count;
-	self->hdr->checksum = 0;
-	self->hdr->resvd[0] = 0;
-	self->hdr->resvd[1] = 0;
-	self->hdr->resvd[2] = 0;
-	self->hdr->resvd[3] = 0;
+	uint32_t root = entry - hdr->entries, top = 0, count = 0;
 
-	size_t size = self->count * self->hdr->entry_size;
+	/* collect the subtree first, so a refusal leaves the table as is */
+	stack[top++] = root;
+	while (count < top) {
+		uint32_t i = stack[count++];
+
+		if (hdr->entries[i].type == FFS_TYPE_PARTITION) {
+			UNEXPECTED("'%s' cannot --delete partition type "
+				   "entries", path);
+			return -1;
+		}
+
+		for (uint32_t c = self->child[i]; c != 0;
+		     c = self->sibling[c - 1])
+			stack[top++] = c - 1;
+	}
+
+	__tree_unlink(self, root);
+
+	for (uint32_t n = 0; n < count; n++)
+		__entry_tombstone(self, stack[n]);
+
+	return 0;
+}
+
+int __ffs_entry_user_get(ffs_t *self, const char *path, uint32_t word,
+			 uint32_t *value)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+	assert(value != NULL);
+
+	if (FFS_USER_WORDS <= word) {
+		UNEXPECTED("word '%d' outside range [0..%d]",
+			   word, FFS_USER_WORDS - 1);
+		return -1;
+	}
+
+	if (__table_load(self) < 0)
+		return -1;
+
+	ffs_entry_t *entry = __find_entry(self, path);
+	if (entry == NULL) {
+		UNEXPECTED("entry '%s' not found in partition table at "
+			   "offset '%llx'", path, (long long)self->offset);
+		return -1;
+	}
+
+	*value = entry->user.data[word];
+
+	return 0;
+}
+
+int __ffs_entry_user_put(ffs_t *self, const char *path, uint32_t word,
+			 uint32_t value)
+{
+	assert(self != NULL);
+	assert(path != NULL);
+
+	if (__check_writable(self) < 0)
+		return -1;
+
+	if (FFS_USER_WORDS <= word) {
+		UNEXPECTED("word '%d' outside range [0..%d]",
+			   word, FFS_USER_WORDS - 1);
+		return -1;
+	}
+
+	ffs_entry_t *entry = __find_entry(self, path);
+	if (entry == NULL) {
+		UNEXPECTED("entry '%s' not found in partition table at "
+			   "offset '%llx'", path, (long long)self->offset);
+		return -1;
+	}
+
+	entry->user.data[word] = value;
+
+	if (__entry_dirty(self, entry) < 0)
+		return -1;
+
+	return 0;
+}
+
+ssize_t __ffs_entry_hexdump(ffs_t * self, const char *path, FILE * out)
+{
+	assert(self != NULL);
+	assert(path != NULL);
 
-	self->hdr = (ffs_hdr_t *) realloc(self->hdr, sizeof(*self->hdr) + size);
-	if (self->hdr == NULL) {
-		ERRNO(errno);
-		goto error;
+	ffs_entry_t entry;
+	if (__ffs_entry_find(self, path, &entry) == false) {
+		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
+			   path, (long long)self->offset);
+		return -1;
 	}
-	memset(self->hdr->entries, 0, size);
 
-	if (__ffs_entry_add(self, FFS_PARTITION_NAME, offset, block_size,
-			    FFS_TYPE_PARTITION, FFS_FLAGS_PROTECTED) < 0)
-		goto error;
-	if (__ffs_entry_truncate(self, FFS_PARTITION_NAME, block_size) < 0)
-		goto error;
+	size_t size = entry.size * self->hdr->block_size;
+	if (entry.actual < size)
+		size = entry.actual;
 
-	if (false) {
- error:
-		if (self != NULL) {
-			if (self->file != NULL)
-				fclose(self->file), self->file = NULL;
-			if (self->path != NULL)
-				free(self->path), self->path = NULL;
-			if (self->hdr != NULL)
-				free(self->hdr), self->hdr = NULL;
-			free(self), self = NULL;
-		}
+	off_t offset = entry.base * self->hdr->block_size;
+
+	ssize_t total = 0;
+
+	size_t block_size = self->hdr->block_size;
+	char block[block_size];
+	while (0 < size) {
+		ssize_t rc = __read_at(self->file, block,
+				       min(block_size, size), offset + total);
+		if (rc < 0)
+			return -1;
+		if (rc == 0)
+			break;
+
+		dump_memory(out, offset + total, block, rc);
+
+		total += rc;
+		size -= rc;
 	}
 
-	return self;
+	return total;
 }
 
-ffs_t *__ffs_create(const char *path, off_t offset, uint32_t block_size,
-		    uint32_t block_count)
+ssize_t __ffs_entry_truncate(ffs_t * self, const char *path, size_t size)
 {
+	assert(self != NULL);
 	assert(path != NULL);
 
-	FILE * file = fopen(path, "r+");
-	if (file == NULL) {
-		ERRNO(errno);
-		return NULL;
+	if (__check_writable(self) < 0)
+		return -1;
+
+	ffs_entry_t * entry = __find_entry(self, path);
+	if (entry == NULL) {
+		UNEXPECTED("entry '%s' not found in partition table at "
+			   "offset '%llx'", path, (long long)self->offset);
+		return -1;
 	}
 
-	ffs_t * self = __ffs_fcreate(file, offset, block_size, block_count);
-	if (self != NULL)
-		self->path = strdup(path);
+	if ((entry->size * self->hdr->block_size) < size) {
+		errno = EFBIG;
+		ERRNO(errno);
+		return -1;
+	} else {
+		entry->actual = size;
+		if (__entry_dirty(self, entry) < 0)
+			return -1;
+	}
 
-	return self;
+	return 0;
 }
 
-ffs_t *__ffs_fopen(FILE * file, off_t offset)
+ssize_t __ffs_entry_read(ffs_t * self, const char *path, void *buf,
+			 off_t offset, size_t count)
 {
-	assert(file != NULL);
+	assert(self != NULL);
+	assert(path != NULL);
+	assert(buf != NULL);
 
-	ffs_t *self = (ffs_t *) malloc(sizeof(*self));
-	if (self == NULL) {
-		ERRNO(errno);
-		goto error;
+	if (count == 0)
+		return 0;
+
+	ffs_entry_t entry;
+	if (__ffs_entry_find(self, path, &entry) == false) {
+		UNEXPECTED("entry '%s' not found in partition table at "
+			   "offset '%llx'", path, (long long)self->offset);
+		return -1;
 	}
 
-	memset(self, 0, sizeof(*self));
-	self->file = file;
-	self->count = 0;
-	self->offset = offset;
-	self->dirty = false;
+	size_t entry_size = entry.size * self->hdr->block_size;
+	if (entry.actual < entry_size)
+		entry_size = entry.actual;
+	off_t entry_offset = entry.base * self->hdr->block_size;
 
-	self->hdr = (ffs_hdr_t *) malloc(sizeof(*self->hdr));
-	if (self->hdr == NULL) {
-		ERRNO(errno);
-		goto error;
-	}
-	memset(self->hdr, 0, sizeof(*self->hdr));
+	if (entry_size <= offset)
+		return 0;
+	else
+		count = min(count, (entry_offset + entry_size) - offset);
 
-	if (__hdr_read(self->hdr, self->file, self->offset) < 0)
-		goto error;
+	ssize_t total = 0;
 
-	self->count = max(self->hdr->entry_count, FFS_ENTRY_EXTENT);
-	size_t size = self->count * self->hdr->entry_size;
+	if (self->map != NULL) {
+		off_t pos = entry_offset + offset;
+		if ((off_t)self->map_size <= pos)
+			return 0;
 
-	self->hdr = (ffs_hdr_t *)realloc(self->hdr, sizeof(*self->hdr) + size);
-	if (self->hdr == NULL) {
-		ERRNO(errno);
-		goto error;
-	}
-	memset(self->hdr->entries, 0, size);
+		total = min(count, self->map_size - pos);
+		memcpy(buf, self->map + pos, total);
 
-	if (0 < self->hdr->entry_count) {
-		if (__entries_read(self->hdr, self->file,
-	 		           self->offset + sizeof(*self->hdr)) < 0)
-			goto error;
+		return total;
 	}
 
-	if (false) {
- error:
-		if (self != NULL) {
-			if (self->hdr != NULL)
-				free(self->hdr), self->hdr = NULL;
+	total = __data_read(self, self->file, buf, count,
+			    entry_offset + offset);
+	if (0 < total)
+		__drop_data(self, entry_offset + offset,
+			    entry_offset + offset + total);
 
-			free(self), self = NULL;
-		}
-	}
+	return total;
+}
 
-	return self;
+/*
+ * Write-if-different.  The destination is read back a chunk at a time and
+ * compared against the new data one erase (table) block at a time, only
+ * runs of blocks that differ are written.  memcmp() is the comparison,
+ * glibc vectorizes it.  Every block is counted as either written or
+ * skipped in the handle's write statistics.
+ */
+static size_t __chunk_size(ffs_t * self)
+{
+	size_t block_size = self->hdr->block_size;
+	size_t chunk = max(block_size, (size_t)FFS_COPY_BUFFER);
+
+	return chunk - chunk % block_size;
 }
 
-ffs_t *__ffs_open(const char *path, off_t offset)
+static uint32_t __blocks(ffs_t * self, off_t offset, size_t size)
 {
-	assert(path != NULL);
+	if (size == 0)
+		return 0;
 
-	FILE *file = fopen(path, "r+");
-	if (file == NULL) {
-		ERRNO(errno);
-		return NULL;
-	}
+	uint32_t block_size = self->hdr->block_size;
 
-	ffs_t *self = __ffs_fopen(file, offset);
-	if (self != NULL)
-		self->path = strdup(path);
+	return (offset + size - 1) / block_size - offset / block_size + 1;
+}
 
-	return self;
+static int __write_runs(ffs_t * self, struct __io *op, size_t n)
+{
+	if (__io_submit(self, op, n) < 0)
+		return -1;
+
+	for (size_t i = 0; i < n; i++)
+		__writeback(self, op[i].offset, op[i].size);
+
+	return 0;
 }
 
-static int ffs_flush(ffs_t * self)
+/*
+ * Queue, in 'op', the runs of blocks of 'data' that differ from 'old',
+ * which holds the first 'have' bytes currently at 'offset'.  'op' is
+ * submitted whenever it fills up, the caller submits what is left.
+ */
+static int __diff_runs(ffs_t * self, const void *data, size_t count,
+		       off_t offset, const void *old, size_t have,
+		       struct __io *op, size_t *runs)
 {
 	assert(self != NULL);
+	assert(runs != NULL);
 
-	if (__hdr_write(self->hdr, self->file, self->offset) < 0)
-		return -1;
+	size_t block_size = self->hdr->block_size;
+	size_t start = 0, end = 0;
+
+	for (size_t i = 0; i < count; ) {
+		size_t n = min(block_size - (offset + i) % block_size,
+			       count - i);
+
+		bool same = i + n <= have &&
+		    memcmp((const char *)old + i,
+			   (const char *)data + i, n) == 0;
+
+		if (same == true) {
+			self->blocks_skipped++;
+		} else {
+			self->blocks_written++;
+			if (start == end)
+				start = i;
+			end = i + n;
+		}
 
-	if (fflush(self->file) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
+		i += n;
+
+		if ((same == true || i == count) && start != end) {
+			op[(*runs)++] = (struct __io) {
+				.file = self->file,
+				.write = true,
+				.buf = (char *)data + start,
+				.size = end - start,
+				.offset = offset + start,
+			};
+
+			if (*runs == FFS_IO_DEPTH) {
+				if (__write_runs(self, op, *runs) < 0)
+					return -1;
+				*runs = 0;
+			}
 
-	self->dirty = false;
+			start = end = 0;
+		}
+	}
 
 	return 0;
 }
 
-int __ffs_info(ffs_t * self, int name, uint32_t *value)
+/* 'old' holds the first 'have' bytes currently at 'offset' */
+static int __write_diff(ffs_t * self, const void *data, size_t count,
+			off_t offset, const void *old, size_t have)
 {
 	assert(self != NULL);
-	assert(value != NULL);
 
-	switch (name) {
-	case FFS_INFO_MAGIC:
-		*value = self->hdr->magic;
-		break;
-	case FFS_INFO_VERSION:
-		*value = self->hdr->version;
-		break;
-	case FFS_INFO_ENTRY_SIZE:
-		*value = self->hdr->entry_size;
-		break;
-	case FFS_INFO_ENTRY_COUNT:
-		*value = self->hdr->entry_count;
-		break;
-	case FFS_INFO_BLOCK_SIZE:
-		*value = self->hdr->block_size;
-		break;
-	case FFS_INFO_BLOCK_COUNT:
-		*value = self->hdr->block_count;
-		break;
-	case FFS_INFO_OFFSET:
-		*value = self->offset;
-		break;
-	default:
-		UNEXPECTED("'%d' invalid info field", name);
+	struct __io op[FFS_IO_DEPTH];
+	size_t runs = 0;
+
+	if (__diff_runs(self, data, count, offset, old, have, op, &runs) < 0)
 		return -1;
-	}
 
-	return 0;
+	return __write_runs(self, op, runs);
 }
 
+static int __write_changed(ffs_t * self, const void *data, size_t count,
+			   off_t offset, void *buf)
+{
+	assert(self != NULL);
 
-int __ffs_fclose(ffs_t * self)
+	ssize_t rc = __data_read(self, self->file, buf, count, offset);
+	if (rc < 0)
+		return -1;
+
+	return __write_diff(self, data, count, offset, buf, rc);
+}
+
+ssize_t __ffs_entry_write(ffs_t * self, const char *path, const void *buf,
+			  off_t offset, size_t count)
 {
-	if (self == NULL)
-		return 0;
+	assert(self != NULL);
+	assert(path != NULL);
+	assert(buf != NULL);
 
-	if (self->dirty == true)
-		if (ffs_flush(self) < 0)
-			return -1;
+	if (__check_writable(self) < 0)
+		return -1;
 
-	if (self->hdr != NULL)
-		free(self->hdr), self->hdr = NULL;
+	if (count == 0)
+		return 0;
 
-	memset(self, 0, sizeof(*self));
-	free(self);
+	ffs_entry_t *entry = __find_entry(self, path);
+	if (entry == NULL) {
+		UNEXPECTED("entry '%s' not found in partition table at "
+			   "offset '%llx'", path, (long long)self->offset);
+		return -1;
+	}
 
-	return 0;
-}
+	size_t entry_size = entry->size * self->hdr->block_size;
+	off_t entry_offset = entry->base * self->hdr->block_size;
 
-int __ffs_close(ffs_t * self)
-{
-	if (self == NULL)
+	if (entry_size <= offset)
 		return 0;
+	else
+		count = min(count, (entry_offset + entry_size) - offset);
 
-	if (self->dirty == true)
-		if (ffs_flush(self) < 0)
+	off_t pos = entry_offset + offset;
+
+	if (self->write_mode == FFS_WRITE_DIFF) {
+		size_t chunk = min(__chunk_size(self), count);
+
+		RAII(void *, old, malloc(chunk), free);
+		if (old == NULL) {
+			ERRNO(errno);
 			return -1;
+		}
 
-	if (self->path != NULL)
-		free(self->path), self->path = NULL;
-	if (self->file != NULL)
-		fclose(self->file), self->file = NULL;
+		/* chunks end on block boundaries */
+		for (size_t done = 0, n; done < count; done += n) {
+			n = min(chunk - (pos + done) % self->hdr->block_size,
+				count - done);
 
-	return __ffs_fclose(self);
-}
+			if (__write_changed(self, (const char *)buf + done, n,
+					    pos + done, old) < 0)
+				return -1;
+		}
+	} else {
+		if (__data_write(self, self->file, buf, count, pos) < 0)
+			return -1;
+
+		self->blocks_written += __blocks(self, pos, count);
+		__writeback(self, pos, count);
+	}
 
-int __ffs_fsync(ffs_t * self)
-{
-	assert(self != NULL);
+	ssize_t total = count;
 
-	if (fflush(self->file) < 0) {
-		ERRNO(errno);
-		return -1;
+	/* the data now ends at least at offset + total */
+	if (entry->actual < (uint32_t) (offset + total)) {
+		entry->actual = (uint32_t) (offset + total);
+		if (__entry_dirty(self, entry) < 0)
+			return -1;
 	}
 
-	return 0;
+	return total;
 }
 
-static ffs_entry_t *__add_entry_check(ffs_hdr_t * self, off_t offset,
-				      size_t size)
+int __ffs_io_backend(ffs_t * self, int backend)
 {
 	assert(self != NULL);
 
-	int find_overlap(ffs_entry_t * entry) {
-		if (entry->type == FFS_TYPE_LOGICAL)
-			return 0;
+	if (backend != FFS_IO_PREAD && backend != FFS_IO_URING &&
+	    backend != FFS_IO_DIRECT) {
+		UNEXPECTED("'%d' invalid I/O backend", backend);
+		return -1;
+	}
 
-		off_t entry_start = entry->base;
-		off_t entry_end = entry_start + entry->size - 1;
+	if (backend == self->io)
+		return backend;
 
-		off_t new_start = offset / self->block_size;
-		off_t new_end = new_start + (size / self->block_size) - 1;
+	__ring_free(self);
+	__direct_close(self);
+	self->io = FFS_IO_PREAD;
 
-		return !(new_start < entry_start && new_end < entry_start) &&
-  		       !(entry_end < new_start && entry_end < new_end);
-	}
+	if (backend == FFS_IO_URING && __ring_init(self) == true)
+		self->io = FFS_IO_URING;
+	else if (backend == FFS_IO_DIRECT && __direct_open(self) == true)
+		self->io = FFS_IO_DIRECT;
 
-	return __iterate_entries(self, find_overlap);
-}
+	__advise(self, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-int __ffs_iterate_entries(ffs_t * self, int (*func) (ffs_entry_t *))
-{
-	return __iterate_entries(self->hdr, func) != NULL;
+	return self->io;
 }
 
-int __ffs_list_entries(ffs_t * self, const char * name, bool user, FILE * out)
+int __ffs_write_mode(ffs_t * self, int mode)
 {
 	assert(self != NULL);
 
-	if (out == NULL)
-		out = stdout;
-
-	char full_name[4096];
-	regex_t rx;
+	if (mode != FFS_WRITE_ALWAYS && mode != FFS_WRITE_DIFF) {
+		UNEXPECTED("'%d' invalid write mode", mode);
+		return -1;
+	}
 
-	int print_entry(ffs_entry_t * entry)
-	{
-		uint32_t offset = entry->base * self->hdr->block_size;
-		uint32_t size = entry->size * self->hdr->block_size;
+	self->write_mode = mode;
 
-                if (__ffs_entry_name(self, entry, full_name,
-				     sizeof full_name) < 0)
-			return -1;
+	return 0;
+}
 
-		if (regexec(&rx, full_name, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
+/*
+ * Fill the whole of an entry with 'fill'.  A zero fill of a regular file
+ * punches a hole (or zeroes the range) without writing any data, any other
+ * fill reads the entry back a chunk at a time and only writes the blocks
+ * that don't hold the fill already.
+ */
+static int __fill_range(FILE * file, off_t offset, size_t size)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+	int fd = fileno(file);
+	struct stat st;
 
-		fprintf(stdout, "%3d [%08x-%08x:%8x] "
-			"[%c%c%c%c%c%c%c%c%c%c] %s\n",
-			entry->id, offset, offset+size-1, entry->actual,
-			entry->type == FFS_TYPE_LOGICAL ? 'l' : 'd',
-	/* reserved */	'-', '-', '-', '-', '-', '-', '-',
-			entry->flags & FFS_FLAGS_U_BOOT_ENV ? 'b' : '-',
-			entry->flags & FFS_FLAGS_PROTECTED ? 'p' : '-',
-			full_name);
-
-		if (user == true) {
-			for (int i=0; i<FFS_USER_WORDS; i++) {
-				fprintf(stdout, "[%2d] %8x ", i,
-					entry->user.data[i]);
-				if ((i+1) % 4 == 0)
-					fprintf(stdout, "\n");
-			}
-		}
+	if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
 
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      offset, size) == 0)
 		return 0;
-	}
+#ifdef FALLOC_FL_ZERO_RANGE
+	if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+		      offset, size) == 0)
+		return 0;
+#endif
+#endif
+	return -1;
+}
 
-	if (0 < self->count) {
-		if (regcomp(&rx, name, REG_ICASE | REG_NOSUB) != 0) {
-			ERRNO(errno);
-			return-1;
+/* number of blocks in [offset, offset + size) that hold any file data */
+static uint32_t __data_blocks(ffs_t * self, off_t offset, size_t size)
+{
+	uint32_t blocks = __blocks(self, offset, size);
+
+#ifdef SEEK_DATA
+	int fd = fileno(self->file);
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+	if (fd < 0 || pos < 0)
+		return blocks;
+
+	uint32_t block_size = self->hdr->block_size;
+	off_t end = offset + size, next = offset / block_size;
+	uint32_t count = 0;
+
+	for (off_t at = offset; at < end; ) {
+		off_t data = lseek(fd, at, SEEK_DATA);
+		if (data < 0 && errno != ENXIO) {
+			count = blocks;
+			break;
 		}
+		if (data < 0 || end <= data)
+			break;
 
-		fprintf(out, "========================[ PARTITION TABLE 0x%llx "
-			"]=======================\n", (long long)self->offset);
-		fprintf(out, "vers:%04x size:%04x * blk:%06x blk(s):%06x * "
-			"entsz:%06x ent(s):%06x\n",
-			self->hdr->version, self->hdr->size,
-			self->hdr->block_size, self->hdr->block_count,
-			self->hdr->entry_size, self->hdr->entry_count);
-		fprintf(out, "------------------------------------------------"
-			"---------------------------\n");
-
-		(void)__iterate_entries(self->hdr, print_entry);
-
-		fprintf(stdout, "\n");
+		off_t hole = lseek(fd, data, SEEK_HOLE);
+		hole = hole < 0 ? end : min(hole, end);
 
-		regfree(&rx);
+		/* data runs are file system blocks, count each block once */
+		off_t first = max(data / (off_t)block_size, next);
+		off_t last = (hole - 1) / block_size;
+		if (first <= last)
+			count += last - first + 1;
+		next = last + 1;
+		at = hole;
 	}
 
-	return 0;
+	(void)lseek(fd, pos, SEEK_SET);
+
+	return count;
+#else
+	return blocks;
+#endif
 }
 
-int __ffs_entry_find(ffs_t *self, const char *path, ffs_entry_t *entry)
+ssize_t __ffs_entry_fill(ffs_t * self, const char *path, uint8_t fill)
 {
 	assert(self != NULL);
 	assert(path != NULL);
 
-	ffs_entry_t *__entry = __find_entry(self->hdr, path);
-	if (__entry != NULL && entry != NULL)
-		*entry = *__entry;
-
-	return __entry != NULL;
-}
+	if (__check_writable(self) < 0)
+		return -1;
 
-int __ffs_entry_find_parent(ffs_t *self, const char *path, ffs_entry_t *entry)
-{
-	assert(self != NULL);
-	assert(path != NULL);
+	ffs_entry_t *entry = __find_entry(self, path);
+	if (entry == NULL) {
+		UNEXPECTED("entry '%s' not found in partition table at "
+			   "offset '%llx'", path, (long long)self->offset);
+		return -1;
+	}
 
-	if (*path == '/')
-		path++;
+	size_t block_size = self->hdr->block_size;
+	size_t size = entry->size * block_size;
+	off_t offset = entry->base * block_size;
 
-	char __path[strlen(path) + 1];
-	strcpy(__path, path);
-	char *parent_path = dirname(__path);
+	if (size == 0)
+		return 0;
 
-	int found = 0;
+	if (fill == 0) {
+		uint32_t blocks = __blocks(self, offset, size);
+		uint32_t data = __data_blocks(self, offset, size);
 
-	if (strcmp(parent_path, ".") != 0) {
-		ffs_entry_t parent;
+		if (__fill_range(self->file, offset, size) == 0) {
+			/* blocks that were holes already are skipped */
+			self->blocks_written += data;
+			self->blocks_skipped += blocks - data;
+			self->unsynced = true;
+			return size;
+		}
+	}
 
-		found = __ffs_entry_find(self, parent_path, &parent);
+	size_t chunk = min(__chunk_size(self), size);
 
-		if (found && entry != NULL)
-			*entry = parent;
+	RAII(void *, pattern, malloc(chunk), free);
+	RAII(void *, buf, malloc(chunk), free);
+	if (pattern == NULL || buf == NULL) {
+		ERRNO(errno);
+		return -1;
 	}
+	memset(pattern, fill, chunk);
 
-	return found;
+	for (size_t done = 0; done < size; done += chunk)
+		if (__write_changed(self, pattern, min(chunk, size - done),
+				    offset + done, buf) < 0)
+			return -1;
+
+	return size;
 }
 
-int __ffs_entry_name(ffs_t *self, ffs_entry_t *entry, char *name, size_t size)
+/*
+ * Let the kernel move the data between two regular files: the block aligned
+ * head is cloned where the filesystem can share extents (reflink), the rest
+ * goes through copy_file_range().  Returns the number of bytes copied, which
+ * is short (possibly 0) if the files or the kernel don't support it.
+ */
+static ssize_t __copy_kernel(FILE * in, off_t src, FILE * out, off_t dst,
+			     size_t count)
 {
-	assert(self != NULL);
-	assert(entry != NULL);
+	assert(in != NULL);
+	assert(out != NULL);
 
-	ffs_hdr_t *hdr = self->hdr;
+	int in_fd = fileno(in), out_fd = fileno(out);
+	if (in_fd < 0 || out_fd < 0)
+		return 0;
 
-	int __entry_name(ffs_entry_t *parent, char *name, size_t size) {
-		assert(parent != NULL);
-		assert(name != NULL);
-
-		if (parent->pid != FFS_PID_TOPLEVEL) {
-			for (uint32_t i = 0; i < hdr->entry_count; i++) {
-				if (hdr->entries[i].id == parent->pid) {
-					__entry_name(hdr->entries + i, name,
-						     size);
-					break;
-				}
-			}
-		}
+	struct stat in_st, out_st;
+	if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0) {
+		ERRNO(errno);
+		return -1;
+	}
 
-		if (strlen(name) + strlen(parent->name) < size)
-			strcat(name, parent->name);
+	if (!S_ISREG(in_st.st_mode) || !S_ISREG(out_st.st_mode))
+		return 0;
 
-		if (parent->id != entry->id) {
-			if (strlen(name) + strlen("/") < size)
-				strcat(name, "/");
-		}
+	size_t total = 0;
 
-		return 0;
+#ifdef FICLONERANGE
+	size_t blk = out_st.st_blksize;
+
+	if (0 < blk && src % blk == 0 && dst % blk == 0 && blk <= count) {
+		struct file_clone_range range = {
+			.src_fd = in_fd,
+			.src_offset = src,
+			.src_length = count - count % blk,
+			.dest_offset = dst,
+		};
+
+		if (ioctl(out_fd, FICLONERANGE, &range) == 0)
+			total = range.src_length;
 	}
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+	while (total < count) {
+		loff_t in_off = src + total, out_off = dst + total;
+
+		ssize_t rc = copy_file_range(in_fd, &in_off, out_fd, &out_off,
+					     count - total, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS || errno == EXDEV ||
+			    errno == EINVAL || errno == EOPNOTSUPP)
+				break;
+			ERRNO(errno);
+			return -1;
+		}
+		if (rc == 0)
+			break;
 
-	memset(name, 0, size);
+		total += rc;
+	}
+#endif
 
-	return __entry_name(entry, name, size);
+	return total;
 }
 
-int __ffs_entry_add(ffs_t * self, const char *path, off_t offset, uint32_t size,
-		    ffs_type_t type, uint32_t flags)
+static ssize_t __copy_diff(ffs_t * in, off_t src, ffs_t * out, off_t dst,
+			   size_t count)
 {
-	assert(self != NULL);
-	assert(path != NULL);
+	size_t chunk = min(__chunk_size(out), count);
 
-	if (__ffs_entry_find(self, path, NULL) == true) {
-		UNEXPECTED("'%s' entry already exists", path);
+	RAII(void *, block, malloc(chunk), free);
+	RAII(void *, old, malloc(chunk), free);
+	if (block == NULL || old == NULL) {
+		ERRNO(errno);
 		return -1;
 	}
 
-	ffs_entry_t parent = {.id = FFS_PID_TOPLEVEL };
-	(void)__ffs_entry_find_parent(self, path, &parent);
+	size_t total = 0;
 
-	ffs_hdr_t *hdr = self->hdr;
+	while (total < count) {
+		size_t n = min(chunk - (dst + total) % out->hdr->block_size,
+			       count - total);
 
-	if (type != FFS_TYPE_LOGICAL) {
-		ffs_entry_t *overlap = __add_entry_check(hdr, offset, size);
-		if (overlap != NULL) {
-			UNEXPECTED("'%s' at offset %lld and size %d overlaps "
-				   "'%s' at offset %d and size %d",
-				   path, (long long)offset, size, overlap->name,
-				   overlap->base * hdr->block_size,
-				   overlap->size * hdr->block_size);
+		/* both sides in one batch */
+		struct __io op[2] = {
+			{ .file = in->file, .buf = block, .size = n,
+			  .offset = src + total },
+			{ .file = out->file, .buf = old, .size = n,
+			  .offset = dst + total },
+		};
+		if (__io_submit(out, op, 2) < 0)
 			return -1;
-		}
-	}
-
-	int find_empty(ffs_entry_t * empty) {
-		return empty->type == 0;
-	}
-
-	ffs_entry_t *entry = __iterate_entries(hdr, find_empty);
-	if (entry == NULL) {
-		if (self->count <= hdr->entry_count) {
-			size_t new_size;
-			new_size = hdr->entry_size *
-					(self->count + FFS_ENTRY_EXTENT);
 
-			self->hdr = (ffs_hdr_t *) realloc(self->hdr,
-							  sizeof(*self->hdr) +
-							  new_size);
-			assert(self->hdr != NULL);
+		size_t rc = op[0].done;
+		if (rc == 0)
+			break;
 
-			if (hdr != self->hdr)
-				hdr = self->hdr;
+		if (__write_diff(out, block, rc, dst + total, old,
+				 min(rc, (size_t)op[1].done)) < 0)
+			return -1;
 
-			memset(hdr->entries + self->count, 0,
-			       FFS_ENTRY_EXTENT * hdr->entry_size);
+		total += rc;
+	}
 
-			self->count += FFS_ENTRY_EXTENT;
-		}
+	return total;
+}
 
-		entry = hdr->entries + hdr->entry_count;
-	}
+static ssize_t __copy_data(ffs_t * self, FILE * in, off_t src,
+			   FILE * out, off_t dst, size_t count)
+{
+	ssize_t total = __copy_kernel(in, src, out, dst, count);
+	if (total < 0 || (size_t)total == count)
+		return total;
 
-	uint32_t max_id = 0;
+	size_t size = min(count - total, (size_t)FFS_COPY_BUFFER);
 
-	int find_max_id(ffs_entry_t * max) {
-		if (max_id < max->id)
-			max_id = max->id;
-		return 0;
+	RAII(void *, block, malloc(2 * size), free);
+	if (block == NULL) {
+		ERRNO(errno);
+		return -1;
 	}
 
-	(void)__iterate_entries(hdr, find_max_id);
+	/* write chunk k and read chunk k+1 in the same batch */
+	char *buf[2] = { block, (char *)block + size };
 
-	char name[strlen(path) + 1];
-	strcpy(name, path);
-	strncpy(entry->name, basename(name), sizeof(entry->name));
-	entry->id = max_id + 1;
-	entry->pid = parent.id;
-	entry->base = offset / hdr->block_size;
-	entry->size = size / hdr->block_size;
-	entry->type = type;
-	entry->flags = flags;
-	entry->checksum = 0;
+	struct __io op[2] = {
+		{ .file = in, .buf = buf[0], .size = count - total,
+		  .offset = src + total },
+	};
+	op[0].size = min(size, op[0].size);
+	if (__io_submit(self, op, 1) < 0)
+		return -1;
 
-	hdr->entry_count++;
+	size_t done = op[0].done;
 
-    // Need to update 'part' entry as well as ffs hdr
-    // if the required number of blocks changes
-    uint32_t blocksNeeded = (hdr->entry_count * hdr->entry_size + FFS_HDR_SIZE_NO_ENTRY) / hdr->block_size;
-    if(hdr->entry_count * hdr->entry_size + FFS_HDR_SIZE_NO_ENTRY % hdr->block_size)
-    {
-        blocksNeeded++;
-    }
+	for (int k = 0; 0 < done; k ^= 1) {
+		size_t next = total + done;
+		size_t n = min(size, count - next);
 
-    if(hdr->size != blocksNeeded)
-    {
-        ffs_entry_t entry;
-        if (__ffs_entry_find(self, "part", &entry) == false) {
-            UNEXPECTED("entry '%s' not found in table at offset '%llx'",
-                       "part", (long long)self->offset);
-                       return -1;
-        }
+		op[0] = (struct __io) {
+			.file = out, .write = true, .buf = buf[k],
+			.size = done, .offset = dst + total };
+		op[1] = (struct __io) {
+			.file = in, .buf = buf[k ^ 1], .size = n,
+			.offset = src + next };
 
-        int find_entry_id(ffs_entry_t * __entry) {
-              return entry.id == __entry->id;
-        }
+		if (__io_submit(self, op, 0 < n ? 2 : 1) < 0)
+			return -1;
 
-        ffs_entry_t *entry_p = __iterate_entries(hdr, find_entry_id);
-        assert(entry_p != NULL);
+		total = next;
+		done = 0 < n ? op[1].done : 0;
+	}
 
-        hdr->size = blocksNeeded;
-        entry_p->size = blocksNeeded;
-        entry_p->actual = blocksNeeded * hdr->block_size;
-    }
-	self->dirty = true;
+	return total;
+}
 
-	return 0;
+ssize_t __ffs_entry_copy(ffs_t * src, const char *src_name,
+			 ffs_t * dst, const char *dst_name)
+{
+	return __ffs_entry_copy_flags(src, src_name, dst, dst_name, 0);
 }
 
-int __ffs_entry_delete(ffs_t * self, const char *path)
+ssize_t __ffs_entry_copy_flags(ffs_t * src, const char *src_name,
+			       ffs_t * dst, const char *dst_name, int flags)
 {
-	assert(self != NULL);
-	assert(path != NULL);
+	assert(src != NULL);
+	assert(src_name != NULL);
+	assert(dst != NULL);
+	assert(dst_name != NULL);
 
-	ffs_entry_t entry;
-	if (__ffs_entry_find(self, path, &entry) == false) {
+	if (__check_writable(dst) < 0)
+		return -1;
+
+	ffs_entry_t from;
+	if (__ffs_entry_find(src, src_name, &from) == false) {
 		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
-			  path, (long long)self->offset);
+			   src_name, (long long)src->offset);
 		return -1;
 	}
 
-	if (entry.type == FFS_TYPE_PARTITION) {
-		UNEXPECTED("'%s' cannot --delete partition type entries", path);
+	ffs_entry_t *to = __find_entry(dst, dst_name);
+	if (to == NULL) {
+		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
+			   dst_name, (long long)dst->offset);
 		return -1;
 	}
 
-	uint32_t children = 0;
+	size_t count = from.size * src->hdr->block_size;
+	if (from.actual < count)
+		count = from.actual;
+	count = min(count, (size_t)to->size * dst->hdr->block_size);
 
-	int find_children(ffs_entry_t * child) {
-		if (entry.id == child->pid)
-			children++;
-		return 0;
-	}
+	off_t src_offset = from.base * src->hdr->block_size;
+	off_t dst_offset = to->base * dst->hdr->block_size;
 
-	ffs_hdr_t *hdr = self->hdr;
+	bool same = false;
 
-	(void)__iterate_entries(hdr, find_children);
+	struct stat in_st, out_st;
+	if (fstat(fileno(src->file), &in_st) == 0 &&
+	    fstat(fileno(dst->file), &out_st) == 0)
+		same = in_st.st_dev == out_st.st_dev &&
+		       in_st.st_ino == out_st.st_ino;
 
-	if (0 < children) {
-		UNEXPECTED("'%s' has '%d' children, --delete those first",
-			   path, children);
+	if (same == true && src_offset != dst_offset &&
+	    src_offset < dst_offset + (off_t)count &&
+	    dst_offset < src_offset + (off_t)count) {
+		UNEXPECTED("'%s' and '%s' overlap in '%s'",
+			   src_name, dst_name, dst->path);
 		return -1;
 	}
 
-	int find_entry_id(ffs_entry_t * __entry) {
-		return entry.id == __entry->id;
-	}
-
-	ffs_entry_t *entry_p = __iterate_entries(hdr, find_entry_id);
-	assert(entry_p != NULL);
+	/* an entry copied onto itself */
+	ssize_t total = count;
 
-	int start = entry_p - hdr->entries;
-	int count = hdr->entry_count - start;
+	if (same == true && src_offset == dst_offset) {
+		dst->blocks_skipped += __blocks(dst, dst_offset, count);
+	} else if (dst->write_mode == FFS_WRITE_DIFF) {
+		total = __copy_diff(src, src_offset, dst, dst_offset, count);
+	} else {
+		total = __copy_data(dst, src->file, src_offset,
+				    dst->file, dst_offset, count);
+		if (0 < total) {
+			dst->blocks_written += __blocks(dst, dst_offset, total);
+			__writeback(dst, dst_offset, total);
+		}
+	}
+	if (total < 0)
+		return -1;
 
-	memmove(entry_p, entry_p + 1, hdr->entry_size * count);
+	if (flags & FFS_COPY_DATA)
+		return total;
 
-	hdr->entry_count = max(0UL, hdr->entry_count - 1);
-	memset(hdr->entries + hdr->entry_count, 0, hdr->entry_size);
+	if (to->actual < (uint32_t)total) {
+		to->actual = (uint32_t)total;
+		if (__entry_dirty(dst, to) < 0)
+			return -1;
+	}
 
-	self->dirty = true;
+	return total;
+}
 
-	return 0;
+/*
+ * Multi-entry copy and compare.  Entries whose data fits in what is left
+ * of a FFS_COPY_BUFFER are packed into one batch: the reads of every
+ * entry in the batch go in one submission and, for a copy, the writes
+ * (or changed runs) in the next.  With the io_uring backend a wildcard
+ * copy of many small partitions so costs a few io_uring_enter() rather
+ * than at least one per partition.  Larger entries, copies within one
+ * file and handles without a ring take the single entry path, in order.
+ */
+struct __slot {
+	ffs_pair_t *pair;
+	ffs_entry_t *to;
+	off_t src;
+	off_t dst;
+	size_t count;
+	size_t have;
+	char *buf;
+};
+
+struct __batch {
+	struct __slot slot[FFS_IO_DEPTH];
+	size_t n;
+	size_t used;
+};
+
+static bool __batch_fits(struct __batch *b, size_t depth, size_t count)
+{
+	return b->n < depth && count <= FFS_COPY_BUFFER - b->used;
 }
 
-int __ffs_entry_user_get(ffs_t *self, const char *path, uint32_t word,
-			 uint32_t *value)
+static int __copy_batch(ffs_t * src, ffs_t * dst, struct __batch *b,
+			int flags)
 {
-	assert(self != NULL);
-	assert(path != NULL);
-	assert(value != NULL);
+	if (b->n == 0)
+		return 0;
 
-	if (FFS_USER_WORDS <= word) {
-		UNEXPECTED("word '%d' outside range [0..%d]",
-			   word, FFS_USER_WORDS - 1);
-		return -1;
+	bool diff = dst->write_mode == FFS_WRITE_DIFF;
+
+	struct __io op[FFS_IO_DEPTH];
+	size_t k = 0;
+
+	/* every source, and in diff mode every destination, in one batch */
+	for (size_t i = 0; i < b->n; i++) {
+		struct __slot *s = b->slot + i;
+
+		op[k++] = (struct __io) {
+			.file = src->file, .buf = s->buf, .size = s->count,
+			.offset = s->src };
+		if (diff == true)
+			op[k++] = (struct __io) {
+				.file = dst->file,
+				.buf = s->buf + FFS_COPY_BUFFER,
+				.size = s->count, .offset = s->dst };
 	}
 
-	ffs_entry_t *entry = __find_entry(self->hdr, path);
-	if (entry == NULL) {
-		UNEXPECTED("entry '%s' not found in partition table at "
-			   "offset '%llx'", path, (long long)self->offset);
+	if (__io_submit(dst, op, k) < 0)
 		return -1;
-	}
 
-	*value = entry->user.data[word];
+	for (size_t i = 0, j = 0; i < b->n; i++) {
+		struct __slot *s = b->slot + i;
 
-	return 0;
-}
+		s->count = op[j++].done;
+		if (diff == true)
+			s->have = min(s->count, (size_t)op[j++].done);
+	}
 
-int __ffs_entry_user_put(ffs_t *self, const char *path, uint32_t word,
-			 uint32_t value)
-{
-	assert(self != NULL);
-	assert(path != NULL);
+	/* then every write in the next */
+	size_t runs = 0;
 
-	if (FFS_USER_WORDS <= word) {
-		UNEXPECTED("word '%d' outside range [0..%d]",
-			   word, FFS_USER_WORDS - 1);
-		return -1;
+	for (size_t i = 0; i < b->n; i++) {
+		struct __slot *s = b->slot + i;
+		uint32_t written = dst->blocks_written;
+		uint32_t skipped = dst->blocks_skipped;
+
+		if (diff == true) {
+			if (__diff_runs(dst, s->buf, s->count, s->dst,
+					s->buf + FFS_COPY_BUFFER, s->have,
+					op, &runs) < 0)
+				return -1;
+		} else if (0 < s->count) {
+			op[runs++] = (struct __io) {
+				.file = dst->file, .write = true,
+				.buf = s->buf, .size = s->count,
+				.offset = s->dst };
+			dst->blocks_written += __blocks(dst, s->dst, s->count);
+		}
+
+		s->pair->rc = s->count;
+		s->pair->written = dst->blocks_written - written;
+		s->pair->skipped = dst->blocks_skipped - skipped;
 	}
 
-	ffs_entry_t *entry = __find_entry(self->hdr, path);
-	if (entry == NULL) {
-		UNEXPECTED("entry '%s' not found in partition table at "
-			   "offset '%llx'", path, (long long)self->offset);
+	if (__write_runs(dst, op, runs) < 0)
 		return -1;
+
+	for (size_t i = 0; i < b->n; i++) {
+		struct __slot *s = b->slot + i;
+
+		if ((flags & FFS_COPY_DATA) || s->count <= s->to->actual)
+			continue;
+
+		s->to->actual = (uint32_t)s->count;
+		if (__entry_dirty(dst, s->to) < 0)
+			return -1;
 	}
 
-	entry->user.data[word] = value;
-	self->dirty = true;
+	b->n = b->used = 0;
 
 	return 0;
 }
 
-ssize_t __ffs_entry_hexdump(ffs_t * self, const char *path, FILE * out)
+int __ffs_entries_copy(ffs_t * src, ffs_t * dst, ffs_pair_t * pair,
+		       size_t n, int flags)
 {
-	assert(self != NULL);
-	assert(path != NULL);
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(pair != NULL);
 
-	ffs_entry_t entry;
-	if (__ffs_entry_find(self, path, &entry) == false) {
-		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
-			   path, (long long)self->offset);
+	if (__check_writable(dst) < 0)
 		return -1;
-	}
 
-	size_t size = entry.size * self->hdr->block_size;
-	if (entry.actual < size)
-		size = entry.actual;
+	bool diff = dst->write_mode == FFS_WRITE_DIFF;
+	size_t depth = diff == true ? FFS_IO_DEPTH / 2 : FFS_IO_DEPTH;
 
-	off_t offset = entry.base * self->hdr->block_size;
+	bool same = true;
 
-	if (fseeko(self->file, offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
+	struct stat in_st, out_st;
+	if (fstat(fileno(src->file), &in_st) == 0 &&
+	    fstat(fileno(dst->file), &out_st) == 0)
+		same = in_st.st_dev == out_st.st_dev &&
+		       in_st.st_ino == out_st.st_ino;
+
+	RAII(char *, buf, NULL, free);
+	if (dst->ring != NULL && same == false) {
+		buf = malloc((diff == true ? 2 : 1) * FFS_COPY_BUFFER);
+		if (buf == NULL) {
+			ERRNO(errno);
+			return -1;
+		}
 	}
 
-	ssize_t total = 0;
+	struct __batch b = { .n = 0 };
 
-	size_t block_size = self->hdr->block_size;
-	char block[block_size];
-	while (0 < size) {
-		size_t rc = fread(block, 1, min(block_size, size),
-				  self->file);
-		if (rc <= 0) {
-			if (ferror(self->file)) {
-				ERRNO(errno);
+	for (size_t i = 0; i < n; i++) {
+		ffs_pair_t *p = pair + i;
+
+		assert(p->src_name != NULL);
+		assert(p->dst_name != NULL);
+
+		p->rc = -1;
+		p->written = p->skipped = 0;
+
+		ffs_entry_t from;
+		if (__ffs_entry_find(src, p->src_name, &from) == false) {
+			UNEXPECTED("entry '%s' not found in table at offset "
+				   "'%llx'", p->src_name,
+				   (long long)src->offset);
+			return -1;
+		}
+
+		ffs_entry_t *to = __find_entry(dst, p->dst_name);
+		if (to == NULL) {
+			UNEXPECTED("entry '%s' not found in table at offset "
+				   "'%llx'", p->dst_name,
+				   (long long)dst->offset);
+			return -1;
+		}
+
+		size_t count = from.size * src->hdr->block_size;
+		if (from.actual < count)
+			count = from.actual;
+		count = min(count, (size_t)to->size * dst->hdr->block_size);
+
+		if (buf != NULL && 0 < count && count <= FFS_COPY_BUFFER) {
+			if (__batch_fits(&b, depth, count) == false &&
+			    __copy_batch(src, dst, &b, flags) < 0)
 				return -1;
-			}
-			break;
+
+			b.slot[b.n++] = (struct __slot) {
+				.pair = p, .to = to,
+				.src = from.base * src->hdr->block_size,
+				.dst = to->base * dst->hdr->block_size,
+				.count = count, .buf = buf + b.used };
+			b.used += count;
+			continue;
 		}
 
-		dump_memory(out, offset + total, block, rc);
+		/* the single entry path, after what is already queued */
+		if (__copy_batch(src, dst, &b, flags) < 0)
+			return -1;
 
-		total += rc;
-		size -= rc;
+		uint32_t written = dst->blocks_written;
+		uint32_t skipped = dst->blocks_skipped;
+
+		p->rc = __ffs_entry_copy_flags(src, p->src_name, dst,
+					       p->dst_name, flags);
+		if (p->rc < 0)
+			return -1;
+
+		p->written = dst->blocks_written - written;
+		p->skipped = dst->blocks_skipped - skipped;
 	}
 
-	return total;
+	return __copy_batch(src, dst, &b, flags);
 }
 
-ssize_t __ffs_entry_truncate(ffs_t * self, const char *path, size_t size)
+/*
+ * Compare.  Both sides are read a chunk at a time in one batch (or used
+ * in place when the handle is mapped) and whole chunks are checked with
+ * memcmp(), which glibc vectorizes, so identical data costs one pass.
+ * Only a chunk that differs is scanned, a word at a time, for the exact
+ * bounds of each run of differing bytes.  Runs less than a word apart
+ * are merged, also across chunks, before being handed to the caller.
+ */
+#define COMPARE_SKIP		4096UL
+
+struct __diff {
+	ffs_compare_fn func;
+	void *ctx;
+	off_t offset;
+	size_t size;
+	ssize_t count;
+};
+
+static inline uint64_t __load64(const uint8_t * p)
 {
-	assert(self != NULL);
-	assert(path != NULL);
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
 
-	ffs_entry_t * entry = __find_entry(self->hdr, path);
-	if (entry == NULL) {
-		UNEXPECTED("entry '%s' not found in partition table at "
-			   "offset '%llx'", path, (long long)self->offset);
-		return -1;
-	}
+/* index of the first non-0 byte of 'v' in memory order */
+static inline size_t __first_byte(uint64_t v)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	return __builtin_ctzll(v) / 8;
+#else
+	return __builtin_clzll(v) / 8;
+#endif
+}
 
-	if ((entry->size * self->hdr->block_size) < size) {
-		errno = EFBIG;
-		ERRNO(errno);
-		return -1;
-	} else {
-		entry->actual = size;
-		self->dirty = true;
+/* first index in [i, n) where 'a' and 'b' differ, or 'n' */
+static size_t __diff_next(const uint8_t * a, const uint8_t * b,
+			  size_t i, size_t n)
+{
+	while (i + COMPARE_SKIP <= n && memcmp(a + i, b + i, COMPARE_SKIP) == 0)
+		i += COMPARE_SKIP;
+
+	for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+		uint64_t x = __load64(a + i) ^ __load64(b + i);
+		if (x != 0)
+			return i + __first_byte(x);
 	}
 
-	return 0;
+	for (; i < n; i++)
+		if (a[i] != b[i])
+			return i;
+
+	return n;
 }
 
-ssize_t __ffs_entry_read(ffs_t * self, const char *path, void *buf,
-			 off_t offset, size_t count)
+/* first index in [i, n) where 'a' and 'b' agree, or 'n' */
+static size_t __same_next(const uint8_t * a, const uint8_t * b,
+			  size_t i, size_t n)
 {
-	assert(self != NULL);
-	assert(path != NULL);
-	assert(buf != NULL);
+	const uint64_t low = 0x7F7F7F7F7F7F7F7FULL;
 
-	if (count == 0)
-		return 0;
+	for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+		uint64_t x = __load64(a + i) ^ __load64(b + i);
 
-	ffs_entry_t entry;
-	if (__ffs_entry_find(self, path, &entry) == false) {
-		UNEXPECTED("entry '%s' not found in partition table at "
-			   "offset '%llx'", path, (long long)self->offset);
-		return -1;
+		/* 0x80 in each byte of 'x' that is 0, exact */
+		uint64_t z = ~(((x & low) + low) | x | low);
+		if (z != 0)
+			return i + __first_byte(z);
 	}
 
-	size_t entry_size = entry.size * self->hdr->block_size;
-	if (entry.actual < entry_size)
-		entry_size = entry.actual;
-	off_t entry_offset = entry.base * self->hdr->block_size;
+	for (; i < n; i++)
+		if (a[i] == b[i])
+			return i;
 
-	if (entry_size <= offset)
+	return n;
+}
+
+static int __diff_flush(struct __diff *self)
+{
+	if (self->size == 0)
 		return 0;
-	else
-		count = min(count, (entry_offset + entry_size) - offset);
 
-	ssize_t total = 0;
+	size_t size = self->size;
+	self->size = 0;
+	self->count++;
 
-	if (fseeko(self->file, entry_offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
+	return self->func(self->offset, size, self->ctx);
+}
 
-	if (fseeko(self->file, offset, SEEK_CUR) != 0) {
-		ERRNO(errno);
-		return -1;
+static int __diff_add(struct __diff *self, off_t offset, size_t size)
+{
+	if (0 < self->size &&
+	    offset < self->offset + (off_t)(self->size + sizeof(uint64_t))) {
+		self->size = offset + size - self->offset;
+		return 0;
 	}
 
-	while (0 < count) {
-		size_t rc = fread(buf + total, 1, count, self->file);
-		if (rc <= 0) {
-			if (ferror(self->file)) {
-				ERRNO(errno);
-				return -1;
-			}
-			break;
-		}
+	int rc = __diff_flush(self);
+	if (rc != 0)
+		return rc;
 
-		total += rc;
-		count -= rc;
-	}
+	self->offset = offset;
+	self->size = size;
 
-	return total;
+	return 0;
 }
 
-ssize_t __ffs_entry_write(ffs_t * self, const char *path, const void *buf,
-			  off_t offset, size_t count)
+/*
+ * Report the ranges where the 'n' bytes of 'a' at 'offset' differ from
+ * 'b', of which only the first 'm' bytes exist.
+ */
+static int __diff_chunk(struct __diff *self, const uint8_t * a,
+			const uint8_t * b, size_t n, size_t m, off_t offset)
 {
-	assert(self != NULL);
-	assert(path != NULL);
-	assert(buf != NULL);
+	int rc = 0;
 
-	if (count == 0)
+	if (m == n && memcmp(a, b, n) == 0)
 		return 0;
 
-	ffs_entry_t *entry = __find_entry(self->hdr, path);
-	if (entry == NULL) {
-		UNEXPECTED("entry '%s' not found in partition table at "
-			   "offset '%llx'", path, (long long)self->offset);
-		return -1;
-	}
-
-	size_t entry_size = entry->size * self->hdr->block_size;
-	off_t entry_offset = entry->base * self->hdr->block_size;
-
-	if (entry_size <= offset)
-		return 0;
-	else
-		count = min(count, (entry_offset + entry_size) - offset);
+	size_t i = __diff_next(a, b, 0, m);
 
-	ssize_t total = 0;
+	while (rc == 0 && i < m) {
+		size_t j = __same_next(a, b, i, m);
+		rc = __diff_add(self, offset + i, j - i);
+		i = __diff_next(a, b, j, m);
 
-	if (fseeko(self->file, entry_offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
+		/* a word of agreeing bytes ends the run */
+		if (rc == 0 && j + sizeof(uint64_t) <= i)
+			rc = __diff_flush(self);
 	}
 
-	if (fseeko(self->file, offset, SEEK_CUR) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
+	/* past the end of the destination data */
+	if (rc == 0 && m < n)
+		rc = __diff_add(self, offset + m, n - m);
 
-	while (0 < count) {
-		size_t rc = fwrite(buf + total, 1, count, self->file);
-		if (rc <= 0) {
-			if (ferror(self->file)) {
-				ERRNO(errno);
-				return -1;
-			}
-			break;
-		}
-		total += rc;
-		count -= rc;
-	}
+	return rc;
+}
 
-	fflush(self->file);
+/* entry data size, clipped to what a mapped handle holds */
+static size_t __compare_size(ffs_t * self, ffs_entry_t * entry)
+{
+	size_t size = entry->size * self->hdr->block_size;
+	if (entry->actual < size)
+		size = entry->actual;
+
+	if (self->map != NULL) {
+		off_t offset = entry->base * self->hdr->block_size;
 
-	if (entry->actual < (uint32_t) total) {
-		entry->actual = (uint32_t) total;
-		self->dirty = true;
+		if ((off_t)self->map_size <= offset)
+			return 0;
+		size = min(size, self->map_size - offset);
 	}
 
-	return total;
+	return size;
 }
 
-#if 0
-ssize_t __ffs_entry_copy(ffs_t *self, ffs_t *in, const char *path)
+ssize_t __ffs_entry_compare(ffs_t * src, const char *src_name,
+			    ffs_t * dst, const char *dst_name,
+			    ffs_compare_fn func, void *ctx)
 {
-	assert(self != NULL);
-	assert(in != NULL);
-	assert(path != NULL);
-
-	if (*path == '\0')
-		return 0;
+	assert(src != NULL);
+	assert(src_name != NULL);
+	assert(dst != NULL);
+	assert(dst_name != NULL);
+	assert(func != NULL);
 
-	ffs_entry_t *src = __find_entry(in->hdr, path);
-	if (src == NULL) {
+	ffs_entry_t from;
+	if (__ffs_entry_find(src, src_name, &from) == false) {
 		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
-			   path, in->offset);
+			   src_name, (long long)src->offset);
 		return -1;
 	}
 
-	ffs_entry_t *dest = __find_entry(self->hdr, path);
-	if (dest == NULL) {
+	ffs_entry_t to;
+	if (__ffs_entry_find(dst, dst_name, &to) == false) {
 		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
-			   path, self->offset);
+			   dst_name, (long long)dst->offset);
 		return -1;
 	}
 
-	if (src->base != dest->base) {
-		UNEXPECTED("partition '%s' offsets differ '%x' != '%x'",
-			   path, src->base, dest->base);
-		return -1;
-	}
+	struct __diff diff = {
+		.func = func, .ctx = ctx,
+	};
 
-	if (src->size != dest->size) {
-		UNEXPECTED("partition '%s' sizes differ '%x' != '%x'",
-			   path, src->size, dest->size);
-		return -1;
-	}
+	size_t count = __compare_size(src, &from);
+	size_t have = __compare_size(dst, &to);
+	if (count == 0)
+		return 0;
 
-	size_t block_size = self->hdr->block_size;
-	off_t src_offset = src->base * in->hdr->block_size;
-	size_t src_actual = src->actual;
-	off_t dest_offset = dest->base * self->hdr->block_size;
+	off_t src_offset = from.base * src->hdr->block_size;
+	off_t dst_offset = to.base * dst->hdr->block_size;
 
-	if (fseeko(in->file, src_offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
+	size_t chunk = min(__chunk_size(dst), count);
 
-	if (fseeko(self->file, dest_offset, SEEK_SET) != 0) {
+	RAII(void *, src_buf, src->map == NULL ? malloc(chunk) : NULL, free);
+	RAII(void *, dst_buf, dst->map == NULL ? malloc(chunk) : NULL, free);
+	if ((src->map == NULL && src_buf == NULL) ||
+	    (dst->map == NULL && dst_buf == NULL)) {
 		ERRNO(errno);
 		return -1;
 	}
 
-	ssize_t total = 0;
-	char block[block_size];
+	size_t total = 0;
 
-	while (0 < src_actual) {
-		size_t count =  min(src_actual, block_size);
+	while (total < count) {
+		size_t n = min(chunk, count - total);
+		size_t m = total < have ? min(n, have - total) : 0;
 
-		size_t rc = fread(block, 1, count, in->file);
-		if (rc <= 0 && ferror(in->file)) {
-			ERRNO(errno);
-			return -1;
+		const uint8_t *a = src_buf, *b = dst_buf;
+		int ia = -1, ib = -1;
+
+		/* both sides in one batch */
+		struct __io op[2];
+		size_t k = 0;
+
+		if (src->map != NULL) {
+			a = src->map + src_offset + total;
+		} else {
+			ia = k;
+			op[k++] = (struct __io) {
+				.file = src->file, .buf = src_buf, .size = n,
+				.offset = src_offset + total };
 		}
 
-		rc = fwrite(block, 1, rc, self->file);
-		if (rc <= 0 && ferror(self->file)) {
-			ERRNO(errno);
-			return -1;
+		if (dst->map != NULL) {
+			b = dst->map + dst_offset + total;
+		} else if (0 < m) {
+			ib = k;
+			op[k++] = (struct __io) {
+				.file = dst->file, .buf = dst_buf, .size = m,
+				.offset = dst_offset + total };
 		}
 
-		total += rc;
-		src_actual -= rc;
-	}
+		if (__io_submit(dst, op, k) < 0)
+			return -1;
 
-	if (dest->actual != (uint32_t)total) {
-		dest->actual = (uint32_t) total;
-		self->dirty = true;
+		if (0 <= ia)
+			n = op[ia].done;
+		if (n == 0)
+			break;
+		if (0 <= ib)
+			m = min(m, (size_t)op[ib].done);
+		m = min(m, n);
+
+		if (__diff_chunk(&diff, a, b, n, m, total) != 0)
+			return diff.count;
+
+		total += n;
 	}
 
-	return total;
+	__diff_flush(&diff);
+
+	return diff.count;
 }
 
-ssize_t __ffs_entry_compare(ffs_t * self, ffs_t * in, const char *path)
+static int __compare_batch(ffs_t * src, ffs_t * dst, struct __batch *b,
+			   ffs_compare_fn func)
 {
-	assert(self != NULL);
-	assert(in != NULL);
-	assert(path != NULL);
-
-	if (*path == '\0')
+	if (b->n == 0)
 		return 0;
 
-	ffs_entry_t *src = __find_entry(in->hdr, path);
-	if (src == NULL) {
-		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
-			   path, in->offset);
-		return -1;
+	struct __io op[FFS_IO_DEPTH];
+	size_t k = 0;
+
+	/* both sides of every entry in one batch */
+	for (size_t i = 0; i < b->n; i++) {
+		struct __slot *s = b->slot + i;
+
+		op[k++] = (struct __io) {
+			.file = src->file, .buf = s->buf, .size = s->count,
+			.offset = s->src };
+		if (0 < s->have)
+			op[k++] = (struct __io) {
+				.file = dst->file,
+				.buf = s->buf + FFS_COPY_BUFFER,
+				.size = s->have, .offset = s->dst };
 	}
 
-	ffs_entry_t *dest = __find_entry(self->hdr, path);
-	if (dest == NULL) {
-		UNEXPECTED("entry '%s' not found in table at offset '%llx'",
-			   path, self->offset);
+	if (__io_submit(dst, op, k) < 0)
 		return -1;
-	}
 
-	if (src->base != dest->base) {
-		UNEXPECTED("partition '%s' offsets differ '%x' != '%x'",
-			   path, src->base, dest->base);
-		return -1;
-	}
+	for (size_t i = 0, j = 0; i < b->n; i++) {
+		struct __slot *s = b->slot + i;
 
-	if (src->size != dest->size) {
-		UNEXPECTED("partition '%s' sizes differ '%x' != '%x'",
-			   path, src->size, dest->size);
-		return -1;
-	}
+		size_t n = op[j++].done, m = 0;
+		if (0 < s->have)
+			m = min(n, (size_t)op[j++].done);
 
-	if (src->actual != dest->actual) {
-		UNEXPECTED("partition '%s' actual sizes differ '%x' != '%x'",
-			   path, src->actual, dest->actual);
-		return -1;
-	}
+		struct __diff diff = {
+			.func = func, .ctx = s->pair->ctx,
+		};
 
-	off_t offset = src->base * self->hdr->block_size;
-	size_t actual = src->actual;
+		if (0 < n && __diff_chunk(&diff, (uint8_t *)s->buf,
+					  (uint8_t *)s->buf + FFS_COPY_BUFFER,
+					  n, m, 0) == 0)
+			__diff_flush(&diff);
 
-	if (fseeko(in->file, offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
+		s->pair->rc = diff.count;
 	}
 
-	if (fseeko(self->file, offset, SEEK_SET) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
+	b->n = b->used = 0;
 
-	ssize_t total = 0;
-	size_t size = 256;
-	char __src[size], __dest[size];
+	return 0;
+}
 
-	while (0 < actual) {
-		size = min(actual, size);
+int __ffs_entries_compare(ffs_t * src, ffs_t * dst, ffs_pair_t * pair,
+			  size_t n, ffs_compare_fn func)
+{
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(pair != NULL);
+	assert(func != NULL);
 
-		size_t rc = fread(__src, 1, size, in->file);
-		if (rc <= 0 && ferror(in->file)) {
+	/* mapped handles are compared in place, without reads */
+	RAII(char *, buf, NULL, free);
+	if (dst->ring != NULL && src->map == NULL && dst->map == NULL) {
+		buf = malloc(2 * FFS_COPY_BUFFER);
+		if (buf == NULL) {
 			ERRNO(errno);
 			return -1;
 		}
+	}
 
-		rc = fread(__dest, 1, size, self->file);
-		if (rc <= 0 && ferror(self->file)) {
-			ERRNO(errno);
+	struct __batch b = { .n = 0 };
+
+	for (size_t i = 0; i < n; i++) {
+		ffs_pair_t *p = pair + i;
+
+		assert(p->src_name != NULL);
+		assert(p->dst_name != NULL);
+
+		p->rc = -1;
+
+		ffs_entry_t from;
+		if (__ffs_entry_find(src, p->src_name, &from) == false) {
+			UNEXPECTED("entry '%s' not found in table at offset "
+				   "'%llx'", p->src_name,
+				   (long long)src->offset);
+			return -1;
+		}
+
+		ffs_entry_t to;
+		if (__ffs_entry_find(dst, p->dst_name, &to) == false) {
+			UNEXPECTED("entry '%s' not found in table at offset "
+				   "'%llx'", p->dst_name,
+				   (long long)dst->offset);
 			return -1;
 		}
 
-		if (memcmp(__src, __dest, size) != 0) {
-			printf("==========> '%s'\n", self->path);
-			dump_memory(stdout, offset + total, __dest, size);
+		size_t count = __compare_size(src, &from);
 
-			printf("==========> '%s'\n", in->path);
-			dump_memory(stdout, offset + total, __src, size);
+		if (buf != NULL && 0 < count && count <= FFS_COPY_BUFFER) {
+			if (__batch_fits(&b, FFS_IO_DEPTH / 2, count) == false &&
+			    __compare_batch(src, dst, &b, func) < 0)
+				return -1;
 
-			break;
+			b.slot[b.n++] = (struct __slot) {
+				.pair = p,
+				.src = from.base * src->hdr->block_size,
+				.dst = to.base * dst->hdr->block_size,
+				.count = count,
+				.have = min(count, __compare_size(dst, &to)),
+				.buf = buf + b.used };
+			b.used += count;
+			continue;
 		}
 
-		actual -= size;
-		total += size;
+		/* the single entry path, after what is already queued */
+		if (__compare_batch(src, dst, &b, func) < 0)
+			return -1;
+
+		p->rc = __ffs_entry_compare(src, p->src_name, dst,
+					    p->dst_name, func, p->ctx);
+		if (p->rc < 0)
+			return -1;
 	}
 
-	return total;
+	return __compare_batch(src, dst, &b, func);
 }
-#endif
 
-int __ffs_entry_list(ffs_t * self, ffs_entry_t ** list)
-{
-	assert(self != NULL);
-	assert(list != NULL);
+struct __list {
+	ffs_entry_t **list;
+	size_t size;
+	size_t count;
+};
 
-	size_t size = 0, count = 0;
-	*list = NULL;
+static int __name_list(ffs_entry_t * entry, void *ctx)
+{
+	struct __list *l = ctx;
 
-	int name_list(ffs_entry_t * entry) {
-		if (size <= count) {
-			size += 10;
+	if (l->size <= l->count) {
+		l->size = max(l->size * 2, FFS_ENTRY_EXTENT);
 
-			*list = realloc(*list, size * sizeof(**list));
-			if (*list == NULL) {
-				ERRNO(errno);
-				return -1;
-			}
+		ffs_entry_t *__list = realloc(*l->list,
+					      l->size * sizeof(**l->list));
+		if (__list == NULL) {
+			ERRNO(errno);
+			return -1;
 		}
+		*l->list = __list;
+	}
 
-		(*list)[count++] = *entry;
+	(*l->list)[l->count++] = *entry;
 
-		return 0;
-	}
+	return 0;
+}
 
-	if (__ffs_iterate_entries(self, name_list) != 0) {
+int __ffs_entry_list(ffs_t * self, ffs_entry_t ** list)
+{
+	assert(self != NULL);
+	assert(list != NULL);
+
+	struct __list l = {.list = list };
+	*list = NULL;
+
+	if (__ffs_iterate_entries_ctx(self, NULL, __name_list, &l) != 0) {
 		if (*list != NULL)
 			free(*list), *list = NULL;
-		count = 0;
 		return -1;
 	}
 
-	return count;
+	return l.count;
 }
 
 /* ============================================================ */
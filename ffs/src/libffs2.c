@@ -131,6 +131,11 @@ ffs_t *ffs_create(const char *path, off_t offset, uint32_t block_size,
 }
 
 ffs_t *ffs_open(const char *path, off_t offset)
+{
+	return ffs_open_flags(path, offset, 0);
+}
+
+ffs_t *ffs_open_flags(const char *path, off_t offset, int flags)
 {
 	FILE * file = fopen(path, "r+");
 	if (file == NULL) {
@@ -143,7 +148,7 @@ ffs_t *ffs_open(const char *path, off_t offset)
 		return NULL;
 	}
 
-	ffs_t *self = __ffs_fopen(file, offset);
+	ffs_t *self = __ffs_fopen_flags(file, offset, flags);
 	if (self == NULL) {
 		fclose(file);
 
@@ -161,6 +166,42 @@ ffs_t *ffs_open(const char *path, off_t offset)
 	return self;
 }
 
+ffs_t *ffs_mopen(const char *path, off_t offset)
+{
+	ffs_t *self = __ffs_mopen(path, offset);
+	if (self == NULL) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+	}
+
+	return self;
+}
+
+const ffs_entry_t *ffs_mentry(ffs_t *self, uint32_t index)
+{
+	const ffs_entry_t *entry = __ffs_mentry(self, index);
+	if (entry == NULL) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+	}
+
+	return entry;
+}
+
 int ffs_info(ffs_t *self, int name, uint32_t *value)
 {
 	int rc = __ffs_info(self, name, value);
@@ -221,6 +262,146 @@ int ffs_fsync(ffs_t * self)
 	return rc;
 }
 
+int ffs_sync_policy(ffs_t * self, int sync)
+{
+	int rc = __ffs_sync_policy(self, sync);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_write_mode(ffs_t * self, int mode)
+{
+	int rc = __ffs_write_mode(self, mode);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_io_backend(ffs_t * self, int backend)
+{
+	int rc = __ffs_io_backend(self, backend);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_txn_begin(ffs_t * self)
+{
+	int rc = __ffs_txn_begin(self);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_txn_commit(ffs_t * self)
+{
+	int rc = __ffs_txn_commit(self);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_txn_abort(ffs_t * self)
+{
+	int rc = __ffs_txn_abort(self);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_verify_all(ffs_t * self)
+{
+	int rc = __ffs_verify_all(self);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
 int ffs_list_entries(ffs_t * self, FILE * out)
 {
 	int rc = __ffs_list_entries(self, ".*", true, out);
@@ -261,6 +442,47 @@ int ffs_iterate_entries(ffs_t * self, int (*func) (ffs_entry_t *))
 	return rc;
 }
 
+int ffs_iterate_entries_ctx(ffs_t * self, ffs_iterate_fn func, void *ctx)
+{
+	int rc = __ffs_iterate_entries_ctx(self, NULL, func, ctx);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_iterate_entries_filter(ffs_t * self, const ffs_filter_t * filter,
+			       ffs_iterate_fn func, void *ctx)
+{
+	int rc = __ffs_iterate_entries_ctx(self, filter, func, ctx);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
 int ffs_entry_find(ffs_t * self, const char *path, ffs_entry_t * entry)
 {
 	int rc = __ffs_entry_find(self, path, entry);
@@ -301,6 +523,46 @@ int ffs_entry_find_parent(ffs_t * self, const char *path, ffs_entry_t * entry)
 	return rc;
 }
 
+int ffs_entry_find_by_offset(ffs_t * self, off_t offset, ffs_entry_t * entry)
+{
+	int rc = __ffs_entry_find_by_offset(self, offset, entry);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_reserve(ffs_t * self, uint32_t count)
+{
+	int rc = __ffs_reserve(self, count);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
 int ffs_entry_add(ffs_t * self, const char *path, off_t offset, size_t size,
 		  ffs_type_t type, uint32_t flags)
 {
@@ -322,6 +584,29 @@ int ffs_entry_add(ffs_t * self, const char *path, off_t offset, size_t size,
 	return rc;
 }
 
+off_t ffs_entry_add_auto(ffs_t * self, const char *path, size_t size,
+			 uint32_t align, int fit, ffs_type_t type,
+			 uint32_t flags)
+{
+	off_t rc = __ffs_entry_add_auto(self, path, size, align, fit, type,
+					flags);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
 int ffs_entry_delete(ffs_t * self, const char *path)
 {
 	int rc = __ffs_entry_delete(self, path);
@@ -342,6 +627,26 @@ int ffs_entry_delete(ffs_t * self, const char *path)
 	return rc;
 }
 
+int ffs_entry_delete_tree(ffs_t * self, const char *path)
+{
+	int rc = __ffs_entry_delete_tree(self, path);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
 int ffs_entry_user_get(ffs_t * self, const char *path, uint32_t word,
 		       uint32_t * value)
 {
@@ -472,6 +777,134 @@ ssize_t ffs_entry_write(ffs_t * self, const char *path, const void *buf,
 	return rc;
 }
 
+ssize_t ffs_entry_fill(ffs_t * self, const char *path, uint8_t fill)
+{
+	ssize_t rc = __ffs_entry_fill(self, path, fill);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+ssize_t ffs_entry_copy(ffs_t * src, const char *src_name,
+		       ffs_t * dst, const char *dst_name)
+{
+	ssize_t rc = __ffs_entry_copy(src, src_name, dst, dst_name);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+ssize_t ffs_entry_copy_flags(ffs_t * src, const char *src_name,
+			     ffs_t * dst, const char *dst_name, int flags)
+{
+	ssize_t rc = __ffs_entry_copy_flags(src, src_name, dst, dst_name,
+					    flags);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+ssize_t ffs_entry_compare(ffs_t * src, const char *src_name,
+			  ffs_t * dst, const char *dst_name,
+			  ffs_compare_fn func, void *ctx)
+{
+	ssize_t rc = __ffs_entry_compare(src, src_name, dst, dst_name,
+					 func, ctx);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_entries_copy(ffs_t * src, ffs_t * dst, ffs_pair_t * pair, size_t n,
+		     int flags)
+{
+	int rc = __ffs_entries_copy(src, dst, pair, n, flags);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
+int ffs_entries_compare(ffs_t * src, ffs_t * dst, ffs_pair_t * pair, size_t n,
+			ffs_compare_fn func)
+{
+	int rc = __ffs_entries_compare(src, dst, pair, n, func);
+	if (rc < 0) {
+		err_t *err = err_get();
+		assert(err != NULL);
+
+		__error.errnum = err_code(err);
+		snprintf(__error.errstr, sizeof __error.errstr,
+			 "%s: %s : %s(%d) : (code=%d) %.*s\n",
+			 program_invocation_short_name,
+			 err_type_name(err), err_file(err), err_line(err),
+			 err_code(err), err_size(err), (char *)err_data(err));
+
+		rc = -1;
+	}
+
+	return rc;
+}
+
 ssize_t ffs_entry_list(ffs_t * self, ffs_entry_t ** list)
 {
 	ssize_t rc = __ffs_entry_list(self, list);
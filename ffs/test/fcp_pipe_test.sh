@@ -0,0 +1,104 @@
+#!/bin/bash
+# IBM_PROLOG_BEGIN_TAG
+# This is an automatically generated prolog.
+#
+# $Source: ffs/test/fcp_pipe_test.sh $
+#
+# OpenPOWER FFS Project
+#
+# Contributors Listed Below - COPYRIGHT 2014,2015
+# [+] International Business Machines Corp.
+#
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+#
+# fcp_pipe_test.sh
+#
+#  Test case to check that data written by fcp from a pipe, which has
+#  no size, reads back and copies in full, several --buffer chunks long
+#
+
+FPART=${FPART:-fpart}
+FCP=${FCP:-fcp}
+NOR_IMAGE="/tmp/fcp_pipe.nor"
+DATA="/tmp/fcp_pipe.data"
+OUT="/tmp/fcp_pipe.out"
+OFFSET="0x0"
+SIZE="16MiB"
+BLOCK="64KiB"
+DATA_SIZE=3500000
+
+run_ok() {
+	echo $*
+	$*
+	RC=$?
+	if [ $RC -ne 0 ]; then
+		echo FAIL, $*
+		exit $RC
+	fi
+}
+
+create_nor_image() {
+	if [ -f $1 ];then
+		rm $1
+	fi
+	run_ok $FPART --create -t $1 -p $OFFSET -s $SIZE -b $BLOCK
+	run_ok $FPART --add -t $1 -p $OFFSET -n p1 -o 1MiB -s 4MiB -g 0
+	run_ok $FPART --add -t $1 -p $OFFSET -n p2 -o 5MiB -s 4MiB -g 0
+}
+
+check_data() {
+	cmp -n $DATA_SIZE $DATA $OUT
+	RC=$?
+	SIZE_OUT=$(stat -c %s $OUT)
+	if [ $RC -ne 0 -o $SIZE_OUT -ne $DATA_SIZE ]; then
+		echo FAIL, $1 -- read back $SIZE_OUT bytes, expected $DATA_SIZE
+		exit 1
+	fi
+	echo PASS, $1
+}
+
+# Write from a pipe, read back, copy to another entry and read back
+pipe_round_trip() {
+	create_nor_image $NOR_IMAGE
+	head -c $DATA_SIZE /dev/urandom > $DATA
+
+	echo "cat $DATA | $FCP - $NOR_IMAGE:p1 -W -o $OFFSET"
+	cat $DATA | $FCP - $NOR_IMAGE:p1 -W -o $OFFSET
+	RC=$?
+	if [ $RC -ne 0 ]; then
+		echo FAIL, write from a pipe
+		exit $RC
+	fi
+
+	rm -f $OUT
+	run_ok $FCP $NOR_IMAGE:p1 $OUT -R -o $OFFSET
+	check_data "write from a pipe"
+
+	run_ok $FCP $NOR_IMAGE:p1 $NOR_IMAGE:p2 -C -o $OFFSET
+	rm -f $OUT
+	run_ok $FCP $NOR_IMAGE:p2 $OUT -R -o $OFFSET
+	check_data "copy of data written from a pipe"
+}
+
+clean_data() {
+	rm -f $NOR_IMAGE $DATA $OUT
+	exit 0
+}
+
+# Main program starts
+
+pipe_round_trip
+
+# Clean/remove all temporary files
+clean_data
@@ -0,0 +1,257 @@
+#!/bin/bash
+# IBM_PROLOG_BEGIN_TAG
+# This is an automatically generated prolog.
+#
+# $Source: ffs/test/fpart_table_test.sh $
+#
+# OpenPOWER FFS Project
+#
+# Contributors Listed Below - COPYRIGHT 2014,2015
+# [+] International Business Machines Corp.
+#
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+# implied. See the License for the specific language governing
+# permissions and limitations under the License.
+#
+# fpart_table_test.sh
+#
+#  Test case to check the partition tables written by fpart.  The
+#  expected checksums were taken from images built with the baseline
+#  fpart, they cover the header and the entries of each table
+#
+
+FPART=${FPART:-fpart}
+NOR_IMAGE="/tmp/fpart_table.nor"
+BATCH="/tmp/fpart_table.batch"
+ERROR="/tmp/fpart_table.err"
+OFFSET="0x3F0000,0x7F0000"
+TABLES="0x3F0000 0x7F0000"
+SIZE="8MiB"
+BLOCK="64KiB"
+
+# expected table checksums
+ADD_SUM=abec34fcac83b773a46f3809c5da180cbc6ecb6f
+DELETE_SUM=5fb97d46483ca1dff576ceb9309057eda9a16e6e
+READD_SUM=caedbc5b738ecb43ec70b5eb4f862e2a030da3e2
+TRUNC_SUM=2ca2e819b3d5091029fbc4332c4dc9449f6cb918
+DELETE_TREE_SUM=fd926be2dce9118068d8e87958968b6581ef4d2f
+
+
+fpart_ok() {
+	echo $FPART $*
+	$FPART $*
+	RC=$?
+	if [ $RC -ne 0 ]; then
+		echo FAIL, $FPART $*
+		exit $RC
+	fi
+}
+
+fpart_fail() {
+	echo $FPART $*
+	$FPART $* 2> $ERROR
+	RC=$?
+	cat $ERROR
+	if [ $RC -eq 0 ]; then
+		echo FAIL, $FPART $* -- expected an error
+		exit 1
+	fi
+}
+
+fpart_fail_with() {
+	MESSAGE=$1
+	shift
+	fpart_fail $*
+	grep -q "$MESSAGE" $ERROR
+	RC=$?
+	if [ $RC -ne 0 ]; then
+		echo FAIL, $FPART $* -- expected \'$MESSAGE\'
+		exit 1
+	fi
+}
+
+create_nor_image() {
+	if [ -f $1 ];then
+		rm $1
+	fi
+	fpart_ok --create -t $1 -p $OFFSET -s $SIZE -b $BLOCK
+}
+
+word() {
+	od -An -tu4 --endian=big -j $(($2)) -N 4 $1 | tr -d ' '
+}
+
+# checksum of the live part of each table, the slots past entry_count
+# are not part of the layout
+table_sum() {
+	for T in $TABLES; do
+		ENTRY_SIZE=$(word $1 $T+12)
+		ENTRY_COUNT=$(word $1 $T+16)
+		dd if=$1 bs=1 skip=$(($T)) \
+		   count=$((48 + ENTRY_SIZE * ENTRY_COUNT)) 2> /dev/null
+	done | sha1sum | cut -d' ' -f1
+}
+
+check_table() {
+	SUM=$(table_sum $NOR_IMAGE)
+	if [ "$SUM" != "$2" ]; then
+		echo FAIL, $1 -- table checksum $SUM, expected $2
+		exit 1
+	fi
+	echo PASS, $1
+}
+
+# Add, delete, re-add, trunc/user and delete a subtree, one command
+# per edit
+round_trip() {
+	create_nor_image $NOR_IMAGE
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank0 -g 0 -l
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank0/ipl -o 0 -s 256KiB -g 0
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank0/spl -o 256KiB -s 256KiB -g 0
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank1 -g 0 -l
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank1/ipl -o 1MiB -s 256KiB -g 0
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank1/spl -o 0x140000 -s 256KiB -g 0
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n misc -o 2MiB -s 1MiB -g 0
+	check_table "add" $ADD_SUM
+
+	fpart_ok --delete -t $NOR_IMAGE -p $OFFSET -n bank0/spl
+	check_table "delete" $DELETE_SUM
+
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank0/env -o 256KiB -s 128KiB -g 0
+	check_table "add after delete" $READD_SUM
+
+	fpart_ok --trunc -t $NOR_IMAGE -p $OFFSET -n bank1/ipl -s 0x100
+	fpart_ok --user 3 -t $NOR_IMAGE -p $OFFSET -n misc -u 0x1234
+	check_table "trunc and user" $TRUNC_SUM
+
+	fpart_ok --delete -t $NOR_IMAGE -p $OFFSET -n bank1/spl
+	fpart_ok --delete -t $NOR_IMAGE -p $OFFSET -n bank1/ipl
+	fpart_ok --delete -t $NOR_IMAGE -p $OFFSET -n bank1
+	check_table "delete subtree" $DELETE_TREE_SUM
+}
+
+# Same edits, each step in one batch (one transaction)
+round_trip_batch() {
+	create_nor_image $NOR_IMAGE
+	printf 'logical bank0 0\n'\
+'add bank0/ipl 0 256KiB 0\n'\
+'add bank0/spl 256KiB 256KiB 0\n'\
+'logical bank1 0\n'\
+'add bank1/ipl 1MiB 256KiB 0\n'\
+'add bank1/spl 0x140000 256KiB 0\n'\
+'add misc 2MiB 1MiB 0\n' > $BATCH
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+	check_table "batch add" $ADD_SUM
+
+	printf 'delete bank0/spl\n' > $BATCH
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+	check_table "batch delete" $DELETE_SUM
+
+	printf 'add bank0/env 256KiB 128KiB 0\n' > $BATCH
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+	check_table "batch add after delete" $READD_SUM
+
+	printf 'trunc bank1/ipl 0x100\nuser misc 3 0x1234\n' > $BATCH
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+	check_table "batch trunc and user" $TRUNC_SUM
+
+	printf 'delete bank1/spl\ndelete bank1/ipl\ndelete bank1\n' > $BATCH
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+	check_table "batch delete subtree" $DELETE_TREE_SUM
+}
+
+# Deleting a logical partition that has children must fail, also when
+# the children were added through the same open table (batch)
+delete_parent_with_children() {
+	create_nor_image $NOR_IMAGE
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank0 -g 0 -l
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n bank0/ipl -o 0 -s 64KiB -g 0
+	fpart_fail_with children --delete -t $NOR_IMAGE -p $OFFSET -n bank0
+
+	create_nor_image $NOR_IMAGE
+	printf 'logical bank0 0\nadd bank0/ipl 0 64KiB 0\ndelete bank0\n' \
+		> $BATCH
+	fpart_fail_with children --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+
+	printf 'logical bank0 0\nadd bank0/ipl 0 64KiB 0\n' > $BATCH
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+	fpart_fail_with children --delete -t $NOR_IMAGE -p $OFFSET -n bank0
+	fpart_ok --delete -t $NOR_IMAGE -p $OFFSET -n bank0/ipl
+	fpart_ok --delete -t $NOR_IMAGE -p $OFFSET -n bank0
+
+	echo PASS, delete of a parent with children
+}
+
+# A type 0 (empty) record in a table read from the image is reused by
+# the first add, later adds append past it and past the initial capacity
+add_over_empty_record() {
+	create_nor_image $NOR_IMAGE
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n a -o 0 -s 64KiB -g 0
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n b -o 64KiB -s 64KiB -g 0
+
+	# zero the record of 'b' in each table
+	for T in $TABLES; do
+		dd if=/dev/zero of=$NOR_IMAGE bs=1 seek=$(($T + 48 + 2 * 128)) \
+		   count=128 conv=notrunc 2> /dev/null
+	done
+
+	rm -f $BATCH
+	for I in $(seq 1 20); do
+		echo "add e$I $((I * 64))KiB 64KiB 0" >> $BATCH
+	done
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+
+	for T in $TABLES; do
+		ENTRY_COUNT=$(word $NOR_IMAGE $T+16)
+		if [ "$ENTRY_COUNT" != "22" ]; then
+			echo FAIL, add over an empty record -- $ENTRY_COUNT \
+				entries at $T, expected 22
+			exit 1
+		fi
+	done
+
+	echo PASS, add over an empty record
+}
+
+# An alignment only applies to an automatically placed entry, with an
+# explicit offset it is rejected instead of ignored
+align_explicit_offset() {
+	create_nor_image $NOR_IMAGE
+	fpart_fail_with align --add -t $NOR_IMAGE -p $OFFSET -n a -o 64KiB \
+		-s 64KiB -g 0 -i 128KiB
+
+	printf 'add a 64KiB 64KiB 0 128KiB\n' > $BATCH
+	fpart_fail_with align --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+
+	fpart_ok --add -t $NOR_IMAGE -p $OFFSET -n a -o auto -s 64KiB -g 0 \
+		-i 128KiB
+	printf 'add b best 64KiB 0 128KiB\n' > $BATCH
+	fpart_ok --batch $BATCH -t $NOR_IMAGE -p $OFFSET
+
+	echo PASS, align with an explicit offset
+}
+
+clean_data() {
+	rm -f $NOR_IMAGE $BATCH $ERROR
+	exit 0
+}
+
+# Main program starts
+
+round_trip
+round_trip_batch
+delete_parent_with_children
+add_over_empty_record
+align_explicit_offset
+
+# Clean/remove all temporary files
+clean_data
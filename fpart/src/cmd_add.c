@@ -58,6 +58,10 @@ int command_add(args_t * args)
 {
 	assert(args != NULL);
 
+	/* an automatically placed entry gets the same offset in every
+	 * partition table, picked from the first one */
+	off_t auto_offset = -1;
+
 	/* ========================= */
 
 	int add(args_t * args, off_t poffset)
@@ -67,16 +71,32 @@ int command_add(args_t * args)
 		off_t offset = 0;
 		uint32_t size = 0;
 		uint32_t flags = 0;
-
-		rc = parse_offset(args->offset, &offset);
-		if (rc < 0)
-			return rc;
+		uint32_t align = 0;
+		int fit = -1;
+
+		if (args->offset != NULL &&
+		    (!strcasecmp(args->offset, "auto") ||
+		     !strcasecmp(args->offset, "first")))
+			fit = FFS_FIT_FIRST;
+		else if (args->offset != NULL &&
+			 !strcasecmp(args->offset, "best"))
+			fit = FFS_FIT_BEST;
+		else {
+			rc = parse_offset(args->offset, &offset);
+			if (rc < 0)
+				return rc;
+		}
 		rc = parse_size(args->size, &size);
 		if (rc < 0)
 			return rc;
 		rc = parse_size(args->flags, &flags);
 		if (rc < 0)
 			return rc;
+		if (args->align != NULL) {
+			rc = parse_size(args->align, &align);
+			if (rc < 0)
+				return rc;
+		}
 
 		ffs_type_t type = FFS_TYPE_DATA;
 		if (args->logical == f_LOGICAL)
@@ -88,6 +108,17 @@ int command_add(args_t * args)
 		RAII(FILE *, file, fopen_generic(target, "r+", debug), fclose);
 		RAII(ffs_t *, ffs,  __ffs_fopen(file, poffset), __ffs_fclose);
 
+		if (fit != -1 && type != FFS_TYPE_LOGICAL) {
+			if (auto_offset < 0) {
+				rc = __ffs_extent_alloc(ffs, size, align, fit,
+							&auto_offset);
+				if (rc < 0)
+					return rc;
+			}
+
+			offset = auto_offset;
+		}
+
 		rc = __ffs_entry_add(ffs, args->name, offset, size,
 				     type, flags);
 		if (rc < 0)
@@ -0,0 +1,340 @@
+/* IBM_PROLOG_BEGIN_TAG                                                   */
+/* This is an automatically generated prolog.                             */
+/*                                                                        */
+/* $Source: fpart/src/cmd_batch.c $                                       */
+/*                                                                        */
+/* OpenPOWER FFS Project                                                  */
+/*                                                                        */
+/* Contributors Listed Below - COPYRIGHT 2014,2015                        */
+/* [+] International Business Machines Corp.                              */
+/*                                                                        */
+/*                                                                        */
+/* Licensed under the Apache License, Version 2.0 (the "License");        */
+/* you may not use this file except in compliance with the License.       */
+/* You may obtain a copy of the License at                                */
+/*                                                                        */
+/*     http://www.apache.org/licenses/LICENSE-2.0                         */
+/*                                                                        */
+/* Unless required by applicable law or agreed to in writing, software    */
+/* distributed under the License is distributed on an "AS IS" BASIS,      */
+/* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or        */
+/* implied. See the License for the specific language governing           */
+/* permissions and limitations under the License.                         */
+/*                                                                        */
+/* IBM_PROLOG_END_TAG                                                     */
+
+/*
+ *    File: cmd_batch.c
+ *   Descr: --batch implementation
+ *    Date: 10/18/2026
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <ctype.h>
+#include <regex.h>
+
+#include <clib/attribute.h>
+#include <clib/list.h>
+#include <clib/list_iter.h>
+#include <clib/misc.h>
+#include <clib/min.h>
+#include <clib/err.h>
+#include <clib/raii.h>
+
+#include "main.h"
+
+#define BATCH_ARGS_MAX	8
+
+/*
+ * One edit per line, '#' starts a comment:
+ *
+ *   add     <name> <offset|auto|first|best> <size> <flags> [<align>]
+ *   logical <name> <flags>
+ *   delete  <name>
+ *   user    <name> <word> <value>
+ *   trunc   <name> [<size>]
+ *
+ * <name> is a fully qualified entry name.  The edits are applied to each
+ * partition table in one transaction and the table is written once.
+ */
+static int read_lines(const char * path, char *** line, size_t * line_nr)
+{
+	assert(path != NULL);
+	assert(line != NULL);
+	assert(line_nr != NULL);
+
+	/* the script is read once up front, it may be stdin */
+	RAII(FILE*, in, strcmp(path, "-") ? fopen(path, "r") :
+	     fdopen(dup(fileno(stdin)), "r"), fclose);
+	if (in == NULL) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	size_t line_sz = 0;
+	char *buf = NULL;
+	size_t buf_sz = 0;
+
+	while (getline(&buf, &buf_sz, in) != -1) {
+		if (line_sz <= *line_nr) {
+			line_sz += 32;
+			char **__line = realloc(*line, line_sz * sizeof(**line));
+			if (__line == NULL) {
+				ERRNO(errno);
+				free(buf);
+				return -1;
+			}
+			*line = __line;
+		}
+
+		(*line)[(*line_nr)++] = buf;
+		buf = NULL, buf_sz = 0;
+	}
+	free(buf);
+
+	if (ferror(in)) {
+		ERRNO(errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+int command_batch(args_t * args)
+{
+	assert(args != NULL);
+
+	char **line = NULL;
+	size_t line_nr = 0;
+	off_t *auto_offset = NULL;
+
+	void free_lines(void) {
+		for (size_t i = 0; i < line_nr; i++)
+			free(line[i]);
+		free(line), line = NULL;
+		free(auto_offset), auto_offset = NULL;
+	}
+
+	if (read_lines(args->batch, &line, &line_nr) < 0) {
+		free_lines();
+		return -1;
+	}
+
+	/* auto placed entries get the same offset in every table */
+	auto_offset = malloc((line_nr + 1) * sizeof(*auto_offset));
+	if (auto_offset == NULL) {
+		ERRNO(errno);
+		free_lines();
+		return -1;
+	}
+	for (size_t i = 0; i < line_nr; i++)
+		auto_offset[i] = -1;
+
+	/* ========================= */
+
+	int apply(ffs_t * ffs, off_t poffset, size_t n, char * argv[],
+		  int argc)
+	{
+		const char *cmd = argv[0];
+		const char *name = argc < 2 ? NULL : argv[1];
+
+		#define ARGC(min, max)	({				\
+		if (argc < (min) || (max) < argc) {			\
+			UNEXPECTED("%s:%zd: invalid '%s', %d to %d "	\
+				   "arguments expected", args->batch,	\
+				   n + 1, cmd, (min) - 1, (max) - 1);	\
+			return -1;					\
+		}							\
+						})
+
+		if (strcmp(cmd, "add") == 0) {
+			ARGC(5, 6);
+
+			off_t offset = 0;
+			uint32_t size = 0, flags = 0, align = 0;
+			int fit = -1;
+
+			if (!strcasecmp(argv[2], "auto") ||
+			    !strcasecmp(argv[2], "first"))
+				fit = FFS_FIT_FIRST;
+			else if (!strcasecmp(argv[2], "best"))
+				fit = FFS_FIT_BEST;
+			else if (parse_offset(argv[2], &offset) < 0)
+				return -1;
+
+			if (parse_size(argv[3], &size) < 0)
+				return -1;
+			if (parse_size(argv[4], &flags) < 0)
+				return -1;
+			if (argc == 6 && fit == -1) {
+				UNEXPECTED("%s:%zd: invalid 'add', <align> "
+					   "requires offset 'auto', 'first' or "
+					   "'best'", args->batch, n + 1);
+				return -1;
+			}
+			if (argc == 6 && parse_size(argv[5], &align) < 0)
+				return -1;
+
+			if (fit != -1) {
+				if (auto_offset[n] < 0 &&
+				    __ffs_extent_alloc(ffs, size, align, fit,
+						       auto_offset + n) < 0)
+					return -1;
+				offset = auto_offset[n];
+			}
+
+			if (__ffs_entry_add(ffs, name, offset, size,
+					    FFS_TYPE_DATA, flags) < 0)
+				return -1;
+
+			if (args->verbose == f_VERBOSE)
+				printf("%llx: %s: add partition at offset "
+				       "'%llx' size '%x' flags '%x'\n",
+				       (long long)poffset, name,
+				       (long long)offset, size, flags);
+		} else if (strcmp(cmd, "logical") == 0) {
+			ARGC(3, 3);
+
+			uint32_t flags = 0;
+			if (parse_size(argv[2], &flags) < 0)
+				return -1;
+
+			if (__ffs_entry_add(ffs, name, 0, 0,
+					    FFS_TYPE_LOGICAL, flags) < 0)
+				return -1;
+
+			if (args->verbose == f_VERBOSE)
+				printf("%llx: %s: add logical partition flags "
+				       "'%x'\n", (long long)poffset, name,
+				       flags);
+		} else if (strcmp(cmd, "delete") == 0) {
+			ARGC(2, 2);
+
+			if (__ffs_entry_delete(ffs, name) < 0)
+				return -1;
+
+			if (args->verbose == f_VERBOSE)
+				printf("%llx: %s: delete\n",
+				       (long long)poffset, name);
+		} else if (strcmp(cmd, "user") == 0) {
+			ARGC(4, 4);
+
+			uint32_t word = 0, value = 0;
+			if (parse_number(argv[2], &word) < 0)
+				return -1;
+			if (parse_size(argv[3], &value) < 0)
+				return -1;
+
+			if (__ffs_entry_user_put(ffs, name, word, value) < 0)
+				return -1;
+
+			if (args->verbose == f_VERBOSE)
+				printf("%llx: %s: user[%d] = '%x'\n",
+				       (long long)poffset, name, word, value);
+		} else if (strcmp(cmd, "trunc") == 0) {
+			ARGC(2, 3);
+
+			ffs_entry_t entry;
+			if (__ffs_entry_find(ffs, name, &entry) == false) {
+				UNEXPECTED("%s:%zd: entry '%s' not found in "
+					   "table at offset '%llx'",
+					   args->batch, n + 1, name,
+					   (long long)poffset);
+				return -1;
+			}
+
+			uint32_t size = entry.size * ffs->hdr->block_size;
+			if (argc == 3 && parse_size(argv[2], &size) < 0)
+				return -1;
+
+			if (__ffs_entry_truncate(ffs, name, size) < 0)
+				return -1;
+
+			if (args->verbose == f_VERBOSE)
+				printf("%llx: %s: truncate size '%x'\n",
+				       (long long)poffset, name, size);
+		} else {
+			UNEXPECTED("%s:%zd: unknown batch command '%s'",
+				   args->batch, n + 1, cmd);
+			return -1;
+		}
+
+		#undef ARGC
+
+		return 0;
+	}
+
+	int batch(args_t * args, off_t poffset)
+	{
+		const char * target = args->target;
+		int debug = args->debug;
+
+		RAII(FILE*, file, fopen_generic(target, "r+", debug), fclose);
+		if (file == NULL)
+			return -1;
+		RAII(ffs_t*, ffs, __ffs_fopen(file, poffset), __ffs_fclose);
+		if (ffs == NULL)
+			return -1;
+
+		if (__ffs_txn_begin(ffs) < 0)
+			return -1;
+
+		size_t edits = 0;
+
+		for (size_t n = 0; n < line_nr; n++) {
+			char __line[strlen(line[n]) + 1];
+			strcpy(__line, line[n]);
+
+			char *comment = strchr(__line, '#');
+			if (comment != NULL)
+				*comment = '\0';
+
+			char *argv[BATCH_ARGS_MAX + 1], *save = NULL;
+			int argc = 0;
+
+			char *tok = strtok_r(__line, " \t\r\n", &save);
+			while (tok != NULL && argc <= BATCH_ARGS_MAX) {
+				argv[argc++] = tok;
+				tok = strtok_r(NULL, " \t\r\n", &save);
+			}
+
+			if (argc == 0)
+				continue;
+
+			if (apply(ffs, poffset, n, argv, argc) < 0) {
+				(void)__ffs_txn_abort(ffs);
+				return -1;
+			}
+
+			edits++;
+		}
+
+		if (__ffs_txn_commit(ffs) < 0)
+			return -1;
+
+		if (args->verbose == f_VERBOSE)
+			printf("%llx: batch: %zd edit(s) committed\n",
+			       (long long)poffset, edits);
+
+		return 0;
+	}
+
+	/* ========================= */
+
+	int rc = command(args, batch);
+
+	free_lines();
+
+	return rc;
+}
@@ -69,8 +69,13 @@ int command_delete(args_t * args)
 		RAII(FILE*, file, fopen_generic(target, "r+", debug), fclose);
 		RAII(ffs_t*, ffs, __ffs_fopen(file, poffset), __ffs_fclose);
 
-		if (__ffs_entry_delete(ffs, args->name) < 0)
-			return -1;
+		if (args->force == f_FORCE) {
+			if (__ffs_entry_delete_tree(ffs, args->name) < 0)
+				return -1;
+		} else {
+			if (__ffs_entry_delete(ffs, args->name) < 0)
+				return -1;
+		}
 
 		if (args->verbose == f_VERBOSE)
 			printf("%llx: %s: delete\n", (long long)poffset, args->name);
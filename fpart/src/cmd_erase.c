@@ -43,7 +43,6 @@
 #include <getopt.h>
 #include <errno.h>
 #include <ctype.h>
-#include <regex.h>
 
 #include <clib/attribute.h>
 #include <clib/list.h>
@@ -70,7 +69,6 @@ int command_erase(args_t * args)
 			return -1;
 
 	char full_name[page_size];
-	regex_t rx;
 
 	ffs_t * __ffs;
 	off_t __poffset;
@@ -85,13 +83,14 @@ int command_erase(args_t * args)
 
 	int erase_entry(ffs_entry_t * entry)
 	{
-                if (__ffs_entry_name(__ffs, entry, full_name,
+		int match = __ffs_entry_match(__ffs, name, entry);
+		if (match <= 0)
+			return match;
+
+		if (__ffs_entry_name(__ffs, entry, full_name,
 				     sizeof full_name) < 0)
 			return -1;
 
-		if (regexec(&rx, full_name, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
-
 		if (entry->flags & FFS_FLAGS_PROTECTED &&
 		    args->force != f_FORCE) {
 			if (args->verbose == f_VERBOSE)
@@ -192,15 +191,8 @@ int command_erase(args_t * args)
 
 	/* ========================= */
 
-	if (regcomp(&rx, name, REG_ICASE | REG_NOSUB) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
-
 	int rc = command(args, erase);
 
-	regfree(&rx);
-
 	while (!list_empty(&list))
 		free(container_of(list_remove_head(&list),
 				  ffs_entry_node_t, node));
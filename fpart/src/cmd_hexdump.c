@@ -43,7 +43,6 @@
 #include <getopt.h>
 #include <errno.h>
 #include <ctype.h>
-#include <regex.h>
 
 #include <clib/attribute.h>
 #include <clib/list.h>
@@ -65,7 +64,6 @@ int command_hexdump(args_t * args)
 		strcat(name, "$");
 
 	char full_name[page_size];
-	regex_t rx;
 
 	off_t __poffset;
 	ffs_t * __ffs;
@@ -80,13 +78,14 @@ int command_hexdump(args_t * args)
 
 	int hexdump_entry(ffs_entry_t * entry)
 	{
-                if (__ffs_entry_name(__ffs, entry, full_name,
+		int match = __ffs_entry_match(__ffs, name, entry);
+		if (match <= 0)
+			return match;
+
+		if (__ffs_entry_name(__ffs, entry, full_name,
 				     sizeof full_name) < 0)
 			return -1;
 
-		if (regexec(&rx, full_name, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
-
 		if (entry->flags & FFS_FLAGS_PROTECTED &&
 		    args->force != f_FORCE) {
 			printf("%llx: %s: protected, skipping hexdump\n",
@@ -142,15 +141,8 @@ int command_hexdump(args_t * args)
 
 	/* ========================= */
 
-	if (regcomp(&rx, name, REG_ICASE | REG_NOSUB) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
-
 	int rc = command(args, hexdump);
 
-	regfree(&rx);
-
 	while (!list_empty(&list))
 		free(container_of(list_remove_head(&list),
 				  ffs_entry_node_t, node));
@@ -43,7 +43,6 @@
 #include <getopt.h>
 #include <errno.h>
 #include <ctype.h>
-#include <regex.h>
 
 #include <clib/attribute.h>
 #include <clib/list.h>
@@ -67,7 +66,6 @@ int command_list(args_t * args)
 	ffs_t *__ffs;
 
 	char full_name[page_size];
-	regex_t rx;
 
 	/* ========================= */
 
@@ -77,13 +75,14 @@ int command_list(args_t * args)
 		uint32_t offset = entry->base * __ffs->hdr->block_size;
 		uint32_t size = entry->size * __ffs->hdr->block_size;
 
-                if (__ffs_entry_name(__ffs, entry, full_name,
+		int match = __ffs_entry_match(__ffs, name, entry);
+		if (match <= 0)
+			return match;
+
+		if (__ffs_entry_name(__ffs, entry, full_name,
 				     sizeof full_name) < 0)
 			return -1;
 
-		if (regexec(&rx, full_name, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
-
 		char type;
 		if (entry->type == FFS_TYPE_LOGICAL) {
 			type ='l';
@@ -161,14 +160,5 @@ int command_list(args_t * args)
 
 	/* ========================= */
 
-	if (regcomp(&rx, name, REG_ICASE | REG_NOSUB) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
-
-	int rc = command(args, list);
-
-	regfree(&rx);
-
-	return rc;
+	return command(args, list);
 }
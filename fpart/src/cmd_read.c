@@ -81,7 +81,8 @@ int command_read(args_t * args)
 		RAII(FILE*, file, fopen_generic(target, "r", debug), fclose);
 		if (file == NULL)
 			return -1;
-		RAII(ffs_t*, ffs, __ffs_fopen(file, poffset), __ffs_fclose);
+		RAII(ffs_t*, ffs, __ffs_fopen_flags(file, poffset,
+				FFS_OPEN_LAZY), __ffs_fclose);
 		if (ffs == NULL)
 			return -1;
 
@@ -43,7 +43,6 @@
 #include <getopt.h>
 #include <errno.h>
 #include <ctype.h>
-#include <regex.h>
 
 #include <clib/list.h>
 #include <clib/list_iter.h>
@@ -67,19 +66,19 @@ int command_trunc(args_t * args)
 	ffs_t * __ffs;
 
 	char full_name[page_size];
-	regex_t rx;
 
 	/* ========================= */
 
 	int trunc_entry(ffs_entry_t * entry)
 	{
-                if (__ffs_entry_name(__ffs, entry, full_name,
+		int match = __ffs_entry_match(__ffs, name, entry);
+		if (match <= 0)
+			return match;
+
+		if (__ffs_entry_name(__ffs, entry, full_name,
 				     sizeof full_name) < 0)
 			return -1;
 
-		if (regexec(&rx, full_name, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
-
 		if (entry->flags & FFS_FLAGS_PROTECTED &&
 		    args->force != f_FORCE) {
 			printf("%llx: %s: protected, skipping truncate\n",
@@ -127,14 +126,5 @@ int command_trunc(args_t * args)
 
 	/* ========================= */
 
-	if (regcomp(&rx, name, REG_ICASE | REG_NOSUB) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
-
-	int rc = command(args, trunc);
-
-	regfree(&rx);
-
-	return rc;
+	return command(args, trunc);
 }
@@ -43,7 +43,6 @@
 #include <getopt.h>
 #include <errno.h>
 #include <ctype.h>
-#include <regex.h>
 
 #include <clib/attribute.h>
 #include <clib/list.h>
@@ -66,7 +65,6 @@ int command_write(args_t * args)
 
 	char full_name[page_size];
 	struct stat st;
-	regex_t rx;
 
   	off_t __poffset;
 	ffs_t *__ffs;
@@ -85,13 +83,14 @@ int command_write(args_t * args)
 	{
 		assert(entry != NULL);
 
-                if (__ffs_entry_name(__ffs, entry, full_name,
+		int match = __ffs_entry_match(__ffs, name, entry);
+		if (match <= 0)
+			return match;
+
+		if (__ffs_entry_name(__ffs, entry, full_name,
 				     sizeof full_name) < 0)
 			return -1;
 
-		if (regexec(&rx, full_name, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
-
 		if (entry->flags & FFS_FLAGS_PROTECTED &&
 		    args->force != f_FORCE) {
 			if (args->verbose == f_VERBOSE)
@@ -172,12 +171,13 @@ int command_write(args_t * args)
 			if (rc < 0)
 				return -1;
 
-			__ffs_fsync(__ffs);
-
 			data_offset += rc;
 			data_size -= rc;
 		}
 
+		if (__ffs_fsync(__ffs) < 0)
+			return -1;
+
 		if (args->verbose == f_VERBOSE)
 			printf("%llx: %s: read '%llx' bytes from file '%s'\n",
 		       		__poffset, full_name, st.st_size, args->path);
@@ -215,15 +215,8 @@ int command_write(args_t * args)
 		return -1;
 	}
 
-	if (regcomp(&rx, name, REG_ICASE | REG_NOSUB) != 0) {
-		ERRNO(errno);
-		return -1;
-	}
-
 	int rc = command(args, write);
 
-	regfree(&rx);
-
 	while (!list_empty(&list))
 		free(container_of(list_remove_head(&list),
 				  ffs_entry_node_t, node));
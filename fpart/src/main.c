@@ -75,9 +75,12 @@ static void usage(bool verbose)
 		   "-n boot0 -l\n");
 	fprintf(e, "  fpart --add --target nor --size 1mb --offset 1MiB "
 		   "--flags 0x0 --name boot0/ipl\n");
+	fprintf(e, "  fpart -A -t nor -p 0x3f0000,0x7f0000 -s 1Mb -o auto "
+		   "-i 1MiB -g 0 -n boot0/spl\n");
 	fprintf(e, "  fpart --delete --target nor nor --name boot0/ipl\n");
 	fprintf(e, "  fpart --target nor --write ipl.bin --name boot1/ipl\n");
 	fprintf(e, "  fpart --user 0 -t nor -n boot0/ipl --value 0xFF500FF5\n");
+	fprintf(e, "  fpart --batch edits.txt -t nor -p 0x3f0000,0x7f0000\n");
 	fprintf(e, "  fpart --copy new_nor -t nor -n ipl\n");
 	fprintf(e, "  fpart --compare new_nor -t nor -n bank0\n");
 
@@ -95,7 +98,8 @@ static void usage(bool verbose)
 	fprintf(e, "  -D, --delete         [options]\n");
 	if (verbose)
 		fprintf(e, "\n  Delete partition entry(s) from each specified"
-			" partition offset.\n\n");
+			" partition offset.  Use --force\n  to also delete"
+			" the children of a logical partition entry.\n\n");
 
 	fprintf(e, "  -E, --erase          [options]\n");
 	if (verbose)
@@ -117,7 +121,22 @@ static void usage(bool verbose)
 	fprintf(e, "  -U, --user    <num>  [options]\n");
 	if (verbose)
 		fprintf(e, "\n  Read or write user words of matching partition"
-			" entry(s) for each\n  specified partition offset.\n");
+			" entry(s) for each\n  specified partition offset.\n\n");
+
+	fprintf(e, "  -B, --batch   <file>  [options]\n");
+	if (verbose)
+		fprintf(e, "\n  Apply the edits listed in <file> (use '-' for"
+			" stdin) to each specified\n  partition offset, one"
+			" per line:\n\n"
+			"\tadd     <name> <offset|auto|first|best> <size>"
+			" <flags> [<align>]\n"
+			"\tlogical <name> <flags>\n"
+			"\tdelete  <name>\n"
+			"\tuser    <name> <word> <value>\n"
+			"\ttrunc   <name> [<size>]\n\n"
+			"  The edits are checked together and each partition"
+			" table is written\n  once, if any edit fails the"
+			" table is left unchanged.\n");
 
 	/* =============================== */
 
@@ -150,7 +169,17 @@ static void usage(bool verbose)
 	if (verbose)
 		fprintf(e, "\n  Specifies the offset of a partition entry,"
 			" in bytes from the beginning\n  of the target file"
-			" (or device).\n\n");
+			" (or device).  For --add, 'auto' (or 'first')\n"
+			"  places the entry in the first free extent that"
+			" fits, 'best' in the\n  smallest one.\n\n");
+
+	fprintf(e, "  -i, --align            <size>\n");
+	if (verbose)
+		fprintf(e, "\n  Specifies the alignment, in bytes, of an"
+			" automatically placed\n  partition entry.  <size>"
+			" must be a power of 2, default is the\n  block"
+			" size.  Requires --offset 'auto', 'first' or"
+			" 'best'.\n\n");
 
 	fprintf(e, "  -s, --size             <size>\n");
 	if (verbose)
@@ -225,6 +254,7 @@ static int process_argument(args_t * args, int opt, const char *optarg)
 	case c_TRUNC:		/* trunc */
 	case c_ERASE:		/* erase */
 	case c_USER:		/* user */
+	case c_BATCH:		/* batch */
 		if (args->cmd != c_ERROR) {
 			UNEXPECTED("commands '%c' and '%c' are mutually "
 				   "exclusive", args->cmd, opt);
@@ -234,6 +264,8 @@ static int process_argument(args_t * args, int opt, const char *optarg)
 		args->cmd = (cmd_t) opt;
 		if (args->cmd == c_USER)
 			args->user = strdup(optarg);
+		if (args->cmd == c_BATCH)
+			args->batch = strdup(optarg);
 		break;
 	case o_POFFSET:		/* partition-offset */
 		free(args->poffset);
@@ -265,6 +297,9 @@ static int process_argument(args_t * args, int opt, const char *optarg)
 	case o_PAD:		/* pad */
 		args->pad = strdup(optarg);
 		break;
+	case o_ALIGN:		/* align */
+		args->align = strdup(optarg);
+		break;
 	case f_FORCE:		/* force */
 		args->force = (flag_t) opt;
 		break;
@@ -366,6 +401,7 @@ static int validate_args(args_t * args)
 		UNSUPPORTED(flags, create);
 		UNSUPPORTED(value, create);
 		UNSUPPORTED(pad, create);
+		UNSUPPORTED(align, create);
 	} else if (args->cmd == c_ADD) {
 		REQUIRED(name, add);
 		REQUIRED(flags, add);
@@ -377,6 +413,15 @@ static int validate_args(args_t * args)
 
 		UNSUPPORTED(block, add);
 		UNSUPPORTED(value, add);
+
+		if (args->align != NULL && (args->offset == NULL ||
+		    (strcasecmp(args->offset, "auto") &&
+		     strcasecmp(args->offset, "first") &&
+		     strcasecmp(args->offset, "best")))) {
+			UNEXPECTED("--align requires --offset 'auto', 'first' "
+				   "or 'best'");
+			return -1;
+		}
 	} else if (args->cmd == c_DELETE) {
 		REQUIRED(name, delete);
 
@@ -386,6 +431,7 @@ static int validate_args(args_t * args)
 		UNSUPPORTED(flags, delete);
 		UNSUPPORTED(value, delete);
 		UNSUPPORTED(pad, delete);
+		UNSUPPORTED(align, delete);
 	} else if (args->cmd == c_LIST) {
 		UNSUPPORTED(size, list);
 		UNSUPPORTED(offset, list);
@@ -393,6 +439,7 @@ static int validate_args(args_t * args)
 		UNSUPPORTED(flags, list);
 		UNSUPPORTED(value, list);
 		UNSUPPORTED(pad, list);
+		UNSUPPORTED(align, list);
 	} else if (args->cmd == c_TRUNC) {
 		REQUIRED(name, trunc);
 
@@ -401,6 +448,7 @@ static int validate_args(args_t * args)
 		UNSUPPORTED(flags, trunc);
 		UNSUPPORTED(value, trunc);
 		UNSUPPORTED(pad, trunc);
+		UNSUPPORTED(align, trunc);
 	} else if (args->cmd == c_ERASE) {
 		REQUIRED(name, erase);
 
@@ -408,6 +456,7 @@ static int validate_args(args_t * args)
 		UNSUPPORTED(offset, erase);
 		UNSUPPORTED(flags, erase);
 		UNSUPPORTED(value, erase);
+		UNSUPPORTED(align, erase);
 	} else if (args->cmd == c_USER) {
 		REQUIRED(name, user);
 
@@ -416,6 +465,15 @@ static int validate_args(args_t * args)
 		UNSUPPORTED(block, user);
 		UNSUPPORTED(flags, user);
 		UNSUPPORTED(pad, user);
+		UNSUPPORTED(align, user);
+	} else if (args->cmd == c_BATCH) {
+		UNSUPPORTED(size, batch);
+		UNSUPPORTED(offset, batch);
+		UNSUPPORTED(block, batch);
+		UNSUPPORTED(flags, batch);
+		UNSUPPORTED(value, batch);
+		UNSUPPORTED(pad, batch);
+		UNSUPPORTED(align, batch);
 	} else {
 		UNEXPECTED("invalid command '%c'", args->cmd);
 		return -1;
@@ -455,6 +513,9 @@ static int process_args(args_t * args)
 	case c_USER:
 		rc = command_user(args);
 		break;
+	case c_BATCH:
+		rc = command_batch(args);
+		break;
 	default:
 		UNEXPECTED("NOT IMPLEMENTED YET => '%c'", args->cmd);
 		rc = -1;
@@ -476,6 +537,8 @@ static void free_args(args_t * args)
 	free(args->value);
 	free(args->flags);
 	free(args->pad);
+	free(args->align);
+	free(args->batch);
 }
 
 static void args_dump(args_t * args)
@@ -506,6 +569,10 @@ static void args_dump(args_t * args)
 		printf("value[%s]\n", args->value);
 	if (args->pad != NULL)
 		printf("pad[%s]\n", args->pad);
+	if (args->align != NULL)
+		printf("align[%s]\n", args->align);
+	if (args->batch != NULL)
+		printf("batch[%s]\n", args->batch);
 	for (int i = 0; i < args->opt_nr; i++) {
 		if (args->opt[i] != NULL)
 			printf("opt%d[%s]\n", i, args->opt[i]);
@@ -533,6 +600,7 @@ int main(int argc, char *argv[])
 		{"trunc", no_argument, NULL, c_TRUNC},
 		{"erase", no_argument, NULL, c_ERASE},
 		{"user", required_argument, NULL, c_USER},
+		{"batch", required_argument, NULL, c_BATCH},
 		/* options */
 		{"partition-offset", required_argument, NULL, o_POFFSET},
 		{"target", required_argument, NULL, o_TARGET},
@@ -543,6 +611,7 @@ int main(int argc, char *argv[])
 		{"value", required_argument, NULL, o_VALUE},
 		{"flags", required_argument, NULL, o_FLAGS},
 		{"pad", required_argument, NULL, o_PAD},
+		{"align", required_argument, NULL, o_ALIGN},
 		/* flags */
 		{"force", no_argument, NULL, f_FORCE},
 		{"protected", no_argument, NULL, f_PROTECTED},
@@ -554,7 +623,7 @@ int main(int argc, char *argv[])
 	};
 
 	static const char *short_opt;
-	short_opt = "CADLTEU:p:t:n:o:s:b:u:g:a:frlvdh";
+	short_opt = "CADLTEU:B:p:t:n:o:s:b:u:g:a:i:frlvdh";
 
 	int rc = EXIT_FAILURE;
 
@@ -50,6 +50,7 @@ typedef enum {
 	c_LIST = 'L',
 	c_TRUNC = 'T',
 	c_USER = 'U',
+	c_BATCH = 'B',
 } cmd_t;
 
 typedef enum {
@@ -63,6 +64,7 @@ typedef enum {
 	o_VALUE = 'u',
 	o_FLAGS = 'g',
 	o_PAD = 'a',
+	o_ALIGN = 'i',
 } option_t;
 
 typedef enum {
@@ -90,6 +92,8 @@ typedef struct {
 	char *size, *block;
 	char *user, *value;
 	char *flags, *pad;
+	char *align;
+	char *batch;
 
 	/* flags */
 	flag_t force, logical;
@@ -128,5 +132,6 @@ extern int command_list(args_t *);
 extern int command_trunc(args_t *);
 extern int command_erase(args_t *);
 extern int command_user(args_t *);
+extern int command_batch(args_t *);
 
 #endif /* __MAIN_H__ */